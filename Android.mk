@@ -38,6 +38,7 @@ LOCAL_SRC_FILES := \
 	call.c \
 	snd.c \
 	gprs.c \
+	netlink.c \
 	rfs.c
 
 LOCAL_SHARED_LIBRARIES := \
@@ -49,22 +50,22 @@ LOCAL_STATIC_LIBRARIES := libsamsung-ipc
 LOCAL_CFLAGS := -D_GNU_SOURCE
 
 ifeq ($(TARGET_DEVICE),crespo)
-	LOCAL_CFLAGS += -DDEVICE_IPC_V4
+	LOCAL_CFLAGS += -DDEVICE_IPC_V4 -DDEVICE_CRESPO
 	samsung-ipc_device := crespo
 endif
 
 ifeq ($(TARGET_DEVICE),galaxysmtd)
-	LOCAL_CFLAGS += -DDEVICE_IPC_V4
+	LOCAL_CFLAGS += -DDEVICE_IPC_V4 -DDEVICE_ARIES
 	samsung-ipc_device := aries
 endif
 
 ifeq ($(TARGET_DEVICE),galaxys2)
-	LOCAL_CFLAGS += -DDEVICE_IPC_V4
+	LOCAL_CFLAGS += -DDEVICE_IPC_V4 -DDEVICE_GALAXYS2
 	samsung-ipc_device := galaxys2
 endif
 
 ifeq ($(TARGET_DEVICE),galaxytab)
-	LOCAL_CFLAGS += -DDEVICE_IPC_V4
+	LOCAL_CFLAGS += -DDEVICE_IPC_V4 -DDEVICE_ARIES
 	samsung-ipc_device := aries
 endif
 
@@ -73,10 +74,15 @@ ifeq ($(TARGET_DEVICE),h1)
 endif
 
 ifeq ($(TARGET_DEVICE),maguro)
-	LOCAL_CFLAGS += -DDEVICE_IPC_V4
+	LOCAL_CFLAGS += -DDEVICE_IPC_V4 -DDEVICE_MAGURO
 	samsung-ipc_device := maguro
 endif
 
+# for host builds, selects the host device profile
+ifeq ($(TARGET_DEVICE),host)
+	LOCAL_CFLAGS += -DDEVICE_HOST
+endif
+
 LOCAL_C_INCLUDES := external/libsamsung-ipc/include
 LOCAL_C_INCLUDES += hardware/ril/libsamsung-ipc/include
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/include
@@ -88,7 +94,7 @@ LOCAL_PRELINK_MODULE := false
 ifeq (foo,foo)
 	# build shared library
 	LOCAL_SHARED_LIBRARIES += \
-		libcutils libnetutils libutils liblog
+		libcutils libutils liblog
 	LOCAL_LDLIBS += -lpthread
 	LOCAL_CFLAGS += -DRIL_SHLIB
 	LOCAL_MODULE:= libsamsung-ril
@@ -100,3 +106,18 @@ else
 	LOCAL_MODULE:= samsung-ril
 	include $(BUILD_EXECUTABLE)
 endif
+
+# rtnetlink helpers test, run on the host against a veth interface
+ifeq ($(TARGET_DEVICE),host)
+	include $(CLEAR_VARS)
+
+	LOCAL_SRC_FILES := \
+		netlink.c \
+		tests/netlink-test.c
+
+	LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+	LOCAL_MODULE_TAGS := optional
+	LOCAL_MODULE := samsung-ril-netlink-test
+	include $(BUILD_HOST_EXECUTABLE)
+endif
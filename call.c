@@ -23,6 +23,22 @@
 #include <utils/Log.h>
 
 #include "samsung-ril.h"
+#include "util.h"
+
+/**
+ * Call global vars
+ */
+
+struct ril_call_list ril_call_list;
+struct ril_call_control ril_call_control;
+struct ril_call_control_stats ril_call_control_stats[RIL_CALL_CONTROL_COUNT];
+struct ril_dtmf ril_dtmf;
+
+static const char *ril_call_control_names[RIL_CALL_CONTROL_COUNT] = {
+	"Dial",
+	"Answer",
+	"Hangup",
+};
 
 /**
  * Format conversion utils
@@ -49,6 +65,20 @@ unsigned char ipc2ril_call_list_entry_state(unsigned char call_state)
 	}
 }
 
+int ipc2ril_call_status_state(unsigned char call_state)
+{
+	switch(call_state) {
+		case IPC_CALL_STATE_DIALING:
+			return RIL_CALL_DIALING;
+		case IPC_CALL_STATE_CONNECTING:
+			return RIL_CALL_ALERTING;
+		case IPC_CALL_STATE_CONNECTED:
+			return RIL_CALL_ACTIVE;
+		default:
+			return -1;
+	}
+}
+
 RIL_LastCallFailCause ipc2ril_call_fail_cause(unsigned char end_cause)
 {
 	switch(end_cause) {
@@ -61,16 +91,258 @@ RIL_LastCallFailCause ipc2ril_call_fail_cause(unsigned char end_cause)
 	}
 }
 
+/**
+ * Call list:
+ * The calls are kept in a fixed table, filled from IPC_CALL_LIST and then
+ * kept up to date with IPC_CALL_STATUS, so that GET_CURRENT_CALLS can be
+ * answered without asking the modem. Whenever a call can't be fully known
+ * from a status (new call, unknown state), the table is invalidated and the
+ * next request goes to the modem again.
+ * IPC call ids are the RIL call indexes (list entry idx + 1).
+ */
+
+void ril_call_list_init(void)
+{
+	memset(&ril_call_list, 0, sizeof(ril_call_list));
+
+	// No call while the radio is off
+	ril_call_list.valid = 1;
+}
+
+void ril_call_list_invalidate(void)
+{
+	ril_call_list.valid = 0;
+}
+
+struct ril_call_entry *ril_call_list_find(int index)
+{
+	int i;
+
+	for(i = 0 ; i < RIL_CALL_LIST_MAX ; i++) {
+		if(ril_call_list.entries[i].used && ril_call_list.entries[i].call.index == index)
+			return &(ril_call_list.entries[i]);
+	}
+
+	return NULL;
+}
+
+int ril_call_list_render(void)
+{
+	int count = 0;
+	int i;
+
+	for(i = 0 ; i < RIL_CALL_LIST_MAX ; i++) {
+		if(ril_call_list.entries[i].used)
+			ril_call_list.calls[count++] = &(ril_call_list.entries[i].call);
+	}
+
+	return count;
+}
+
+void ril_call_list_sent_save(void)
+{
+	memcpy(ril_call_list.sent_entries, ril_call_list.entries, sizeof(ril_call_list.sent_entries));
+	ril_call_list.sent_valid = 1;
+}
+
+int ril_call_list_sent_same(void)
+{
+	if(!ril_call_list.valid || !ril_call_list.sent_valid)
+		return 0;
+
+	return memcmp(ril_call_list.sent_entries, ril_call_list.entries,
+		sizeof(ril_call_list.sent_entries)) == 0;
+}
+
+/*
+ * Call state changes are reported once per RIL_CALL_STATE_CHANGED_WINDOW,
+ * and not at all when the calls are the same as last answered to RILJ,
+ * since each report makes RILJ ask for the current calls
+ */
+void ril_call_state_changed_window(void *data)
+{
+	ril_call_list.scheduled = 0;
+
+	if(!ril_call_list.changed)
+		return;
+
+	ril_call_list.changed = 0;
+
+	if(ril_call_list_sent_same()) {
+		LOGD("Calls didn't change, not reporting it");
+		return;
+	}
+
+	RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
+}
+
+void ril_call_state_changed(void)
+{
+	ril_call_list.changed = 1;
+
+	if(ril_call_list.scheduled)
+		return;
+
+	if(ril_timed_callback(ril_call_state_changed_window, NULL,
+		RIL_CALL_STATE_CHANGED_WINDOW) < 0) {
+		ril_call_state_changed_window(NULL);
+		return;
+	}
+
+	ril_call_list.scheduled = 1;
+}
+
+void ril_call_list_status_update(struct ipc_call_status *call_status)
+{
+	struct ril_call_entry *entry;
+	int state;
+
+	if(!ril_call_list.valid)
+		return;
+
+	entry = ril_call_list_find(call_status->id);
+
+	if(call_status->state == IPC_CALL_STATE_RELEASED) {
+		if(entry != NULL)
+			memset(entry, 0, sizeof(struct ril_call_entry));
+		return;
+	}
+
+	state = ipc2ril_call_status_state(call_status->state);
+	if(entry == NULL || state < 0) {
+		LOGD("Call %d can't be updated from its status, invalidating the call list",
+			call_status->id);
+		ril_call_list_invalidate();
+		return;
+	}
+
+	entry->call.state = state;
+}
+
+/**
+ * Call control:
+ * Dial, answer and hangup are completed on the modem IPC_GEN_PHONE_RES.
+ * The last of these requests is timestamped when sent, when acked by the
+ * modem and when the first matching IPC_CALL_STATUS comes in, which gives
+ * the latency of each call setup/release.
+ */
+
+void ril_call_control_init(void)
+{
+	memset(&ril_call_control, 0, sizeof(ril_call_control));
+	memset(ril_call_control_stats, 0, sizeof(ril_call_control_stats));
+
+	ril_call_control.type = -1;
+}
+
+void ril_call_control_start(RIL_Token t, int type, unsigned short command)
+{
+	if(ril_call_control.type >= 0)
+		LOGD("%s request still pending, not timing it anymore",
+			ril_call_control_names[ril_call_control.type]);
+
+	ril_call_control.type = type;
+	ril_call_control.aseq = reqGetId(t);
+	ril_call_control.request_timestamp = ril_timestamp_ms();
+	ril_call_control.ack_timestamp = 0;
+
+	ipc_gen_phone_res_expect_to_func(reqGetId(t), command,
+		ipc_call_control_complete);
+}
+
+void ril_call_control_status(struct ipc_call_status *call_status)
+{
+	struct ril_call_control_stats *stats;
+	long long ack, latency;
+	int type = ril_call_control.type;
+
+	if(type < 0 || ril_call_control.ack_timestamp == 0)
+		return;
+
+	switch(type) {
+		case RIL_CALL_CONTROL_DIAL:
+			if(call_status->state != IPC_CALL_STATE_DIALING &&
+				call_status->state != IPC_CALL_STATE_CONNECTING)
+				return;
+			break;
+		case RIL_CALL_CONTROL_ANSWER:
+			if(call_status->state != IPC_CALL_STATE_CONNECTED)
+				return;
+			break;
+		case RIL_CALL_CONTROL_HANGUP:
+			if(call_status->state != IPC_CALL_STATE_RELEASED)
+				return;
+			break;
+	}
+
+	ack = ril_call_control.ack_timestamp - ril_call_control.request_timestamp;
+	latency = ril_timestamp_ms() - ril_call_control.request_timestamp;
+
+	stats = &(ril_call_control_stats[type]);
+	stats->count++;
+	stats->ack_total += ack;
+	stats->status_total += latency;
+	if(latency > stats->status_max)
+		stats->status_max = latency;
+
+	if(latency >= RIL_CALL_CONTROL_SLOW)
+		LOGE("Slow %s for call %d: modem ack %lldms, call status %lldms",
+			ril_call_control_names[type], call_status->id, ack, latency);
+	else
+		LOGD("%s for call %d: modem ack %lldms, call status %lldms",
+			ril_call_control_names[type], call_status->id, ack, latency);
+
+	LOGD("%s: %u calls, avg ack %lldms, avg call status %lldms, max call status %lldms",
+		ril_call_control_names[type], stats->count, stats->ack_total / stats->count,
+		stats->status_total / stats->count, stats->status_max);
+
+	ril_call_control.type = -1;
+}
+
+/**
+ * In: IPC_GEN_PHONE_RES
+ *   Modem result for IPC_CALL_OUTGOING, IPC_CALL_ANSWER or IPC_CALL_RELEASE
+ *
+ * Out: RIL_REQUEST_DIAL, RIL_REQUEST_ANSWER or RIL_REQUEST_HANGUP
+ */
+void ipc_call_control_complete(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
+	int timed;
+	int rc;
+
+	timed = ril_call_control.type >= 0 && ril_call_control.aseq == info->aseq;
+
+	rc = ipc_gen_phone_res_check(phone_res);
+	if(rc < 0) {
+		LOGE("There was an error during call control!");
+
+		if(timed)
+			ril_call_control.type = -1;
+
+		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	if(timed)
+		ril_call_control.ack_timestamp = ril_timestamp_ms();
+
+	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, NULL, 0);
+}
+
 /**
  * In: RIL_UNSOL_CALL_RING
  *   Ring indication for an incoming call (eg, RING or CRING event).
  */
 void ipc_call_incoming(struct ipc_message_info *info)
 {
+	// The caller number is only given by IPC_CALL_LIST
+	ril_call_list_invalidate();
+
+	// Ringing is never delayed
 	RIL_onUnsolicitedResponse(RIL_UNSOL_CALL_RING, NULL, 0);
 
-	/* FIXME: Do we really need to send this? */
-	RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
+	ril_call_state_changed();
 }
 
 /**
@@ -85,11 +357,18 @@ void ipc_call_status(struct ipc_message_info *info)
 	struct ipc_call_status *call_status =
 		(struct ipc_call_status *) info->data;
 
+	if(info->data == NULL || info->length < sizeof(struct ipc_call_status))
+		return;
+
 	memcpy(&(ril_state.call_status), call_status, sizeof(struct ipc_call_status));
 
 	LOGD("Updating Call Status data");
 
-	RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
+	ril_call_list_status_update(call_status);
+	ril_call_control_status(call_status);
+	ril_dtmf_call_status(call_status);
+
+	ril_call_state_changed();
 }
 
 /**
@@ -105,7 +384,8 @@ void ril_request_dial(RIL_Token t, void *data, size_t datalen)
 	int clir;
 
 	if(strlen(dial->address) > sizeof(call.number)) {
-		printf("Outgoing call number too long\n");
+		LOGE("Outgoing call number too long");
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 		return;
 	}
 
@@ -134,10 +414,9 @@ void ril_request_dial(RIL_Token t, void *data, size_t datalen)
 	call.length = strlen(dial->address);
 	memcpy(call.number, dial->address, strlen(dial->address));
 
+	ril_call_control_start(t, RIL_CALL_CONTROL_DIAL, IPC_CALL_OUTGOING);
+
 	ipc_fmt_send(IPC_CALL_OUTGOING, IPC_TYPE_EXEC, (unsigned char *) &call, sizeof(call), reqGetId(t));
-	
-	/* FIXME: This should actually be sent based on the response from baseband */
-	RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
 }
 
 /**
@@ -149,6 +428,16 @@ void ril_request_dial(RIL_Token t, void *data, size_t datalen)
  */
 void ril_request_get_current_calls(RIL_Token t)
 {
+	int count;
+
+	if(ril_call_list.valid) {
+		count = ril_call_list_render();
+		ril_call_list_sent_save();
+
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, ril_call_list.calls, count * sizeof(RIL_Call *));
+		return;
+	}
+
 	ipc_fmt_send_get(IPC_CALL_LIST, reqGetId(t));
 }
 
@@ -162,52 +451,75 @@ void ril_request_get_current_calls(RIL_Token t)
 void ipc_call_list(struct ipc_message_info *info)
 {
 	struct ipc_call_list_entry *entry;
+	struct ril_call_entry *call_entry;
 	unsigned char num_entries;
-	char *number, *number_ril;
+	unsigned char *end;
+	char *number;
+	int count;
 	int i;
 
+	if(info->data == NULL || info->length < 1)
+		goto error;
+
+	end = (unsigned char *) info->data + info->length;
+
 	num_entries = *((unsigned char *) info->data);
 	entry = (struct ipc_call_list_entry *) ((char *) info->data + 1);
 
-	RIL_Call **calls = (RIL_Call **) malloc(num_entries * sizeof(RIL_Call *));
+	if(num_entries > RIL_CALL_LIST_MAX) {
+		LOGE("%s: too many calls (%d), keeping %d", __FUNCTION__, num_entries, RIL_CALL_LIST_MAX);
+		num_entries = RIL_CALL_LIST_MAX;
+	}
 
-	for(i = 0; i < num_entries; i++) {
-		RIL_Call *call = (RIL_Call *) malloc(sizeof(RIL_Call));
+	memset(ril_call_list.entries, 0, sizeof(ril_call_list.entries));
 
+	for(i = 0; i < num_entries; i++) {
 		/* Number is located after call list entry */
 		number = ((char *) entry) + sizeof(*entry);
 
-		number_ril = (char *) malloc(entry->number_len + 1);
-		memset(number_ril, 0, (entry->number_len + 1));
-		memcpy(number_ril, number, entry->number_len);
-
-		call->state = ipc2ril_call_list_entry_state(entry->state);
-		call->index = (entry->idx+1);
-		call->toa = (entry->number_len > 0 && number[0] == '+') ? 145 : 129;
-		call->isMpty = entry->mpty;
-		call->isMT = (entry->term == IPC_CALL_TERM_MT);
-		call->als = 0;
-		call->isVoice  = (entry->type == IPC_CALL_TYPE_VOICE);
-		call->isVoicePrivacy = 0;
-		call->number = number_ril;
-		call->numberPresentation = (entry->number_len > 0) ? 0 : 2;
-		call->name = NULL;
-		call->namePresentation = 2;
-		call->uusInfo = NULL;
-
-		calls[i] = call;
+		if((unsigned char *) number > end || (unsigned char *) number + entry->number_len > end) {
+			LOGE("%s: truncated call list", __FUNCTION__);
+			goto error;
+		}
+
+		call_entry = &(ril_call_list.entries[i]);
+
+		memcpy(call_entry->number, number, entry->number_len > RIL_CALL_NUMBER_LEN
+			? RIL_CALL_NUMBER_LEN : entry->number_len);
+
+		call_entry->call.state = ipc2ril_call_list_entry_state(entry->state);
+		call_entry->call.index = (entry->idx+1);
+		call_entry->call.toa = (entry->number_len > 0 && number[0] == '+') ? 145 : 129;
+		call_entry->call.isMpty = entry->mpty;
+		call_entry->call.isMT = (entry->term == IPC_CALL_TERM_MT);
+		call_entry->call.als = 0;
+		call_entry->call.isVoice  = (entry->type == IPC_CALL_TYPE_VOICE);
+		call_entry->call.isVoicePrivacy = 0;
+		call_entry->call.number = call_entry->number;
+		call_entry->call.numberPresentation = (entry->number_len > 0) ? 0 : 2;
+		call_entry->call.name = NULL;
+		call_entry->call.namePresentation = 2;
+		call_entry->call.uusInfo = NULL;
+		call_entry->used = 1;
 
 		/* Next entry after current number */
 		entry = (struct ipc_call_list_entry *) (number + entry->number_len);
 	}
 
-	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, calls, (num_entries * sizeof(RIL_Call *)));
+	ril_call_list.valid = 1;
 
-	for(i = 0; i < num_entries; i++) {
-		free(calls[i]);
-	}
+	count = ril_call_list_render();
+	ril_call_list_sent_save();
+
+	if(reqGetToken(info->aseq) != (RIL_Token) 0x00)
+		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, ril_call_list.calls, count * sizeof(RIL_Call *));
+
+	return;
 
-	free(calls);
+error:
+	ril_call_list_invalidate();
+
+	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 /**
@@ -218,13 +530,10 @@ void ipc_call_list(struct ipc_message_info *info)
  */
 void ril_request_hangup(RIL_Token t)
 {
-	ipc_fmt_send_exec(IPC_CALL_RELEASE, reqGetId(t));
-
-	/* FIXME: This should actually be sent based on the response from baseband */
-	RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+	ril_call_control_start(t, RIL_CALL_CONTROL_HANGUP, IPC_CALL_RELEASE);
 
-	/* FIXME: Do we really need to send this? */
-	RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
+	// The call state change is reported with IPC_CALL_STATUS
+	ipc_fmt_send_exec(IPC_CALL_RELEASE, reqGetId(t));
 }
 
 /**
@@ -235,13 +544,10 @@ void ril_request_hangup(RIL_Token t)
  */
 void ril_request_answer(RIL_Token t)
 {
-	ipc_fmt_send_exec(IPC_CALL_ANSWER, reqGetId(t));
-
-	/* FIXME: This should actually be sent based on the response from baseband */
-	RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+	ril_call_control_start(t, RIL_CALL_CONTROL_ANSWER, IPC_CALL_ANSWER);
 
-	/* FIXME: Do we really need to send this? */
-	RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
+	// The call state change is reported with IPC_CALL_STATUS
+	ipc_fmt_send_exec(IPC_CALL_ANSWER, reqGetId(t));
 }
 
 /**
@@ -263,104 +569,380 @@ void ril_request_last_call_fail_cause(RIL_Token t)
 }
 
 /**
- * In: IPC_CALL_BURST_DTMF
- *   Send DTMF burst. RILJ only sends 1 DTMF tone to send at a time.
- *
- * Out: IPC_CALL_BURST_DTMF
- *   It should be possible to send multiple DTMF tones at once in this message.
- *   First byte should be DTMF tones count.
+ * DTMF queue:
+ * DTMF requests are queued and sent to the modem one message at a time.
+ * Consecutive single tones (RIL_REQUEST_DTMF) are sent together in one
+ * IPC_CALL_BURST_DTMF. A tone still being played is stopped before anything
+ * else and the next message is only sent RIL_DTMF_STOP_DELAY after the modem
+ * acked the stop, using a timed callback instead of sleeping.
+ * A message left unanswered for RIL_DTMF_TIMEOUT fails its requests.
  */
-void ril_request_dtmf(RIL_Token t, void *data, int length)
+
+void ril_dtmf_sent_complete(RIL_Errno e);
+
+void ril_dtmf_init(void)
 {
-	struct ipc_call_cont_dtmf cont_dtmf;
+	struct ril_dtmf_request *request;
+	unsigned int sent_serial;
 
-	unsigned char *burst;
-	int burst_len;
+	// The modem is not going to answer anymore
+	ril_dtmf_sent_complete(RIL_E_RADIO_NOT_AVAILABLE);
+
+	while(ril_dtmf.count > 0) {
+		request = &(ril_dtmf.queue[ril_dtmf.head]);
+		RIL_onRequestComplete(request->token, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+
+		ril_dtmf.head = (ril_dtmf.head + 1) % RIL_DTMF_QUEUE_SIZE;
+		ril_dtmf.count--;
+	}
+
+	// Timeouts still pending must not match the next messages
+	sent_serial = ril_dtmf.sent_serial;
+
+	memset(&ril_dtmf, 0, sizeof(ril_dtmf));
+
+	ril_dtmf.sent_serial = sent_serial;
+}
+
+int ril_dtmf_queue_add(RIL_Token t, int type, unsigned char tone)
+{
+	struct ril_dtmf_request *request;
+
+	if(ril_dtmf.count >= RIL_DTMF_QUEUE_SIZE) {
+		LOGE("DTMF queue is full");
+		return -1;
+	}
+
+	request = &(ril_dtmf.queue[(ril_dtmf.head + ril_dtmf.count) % RIL_DTMF_QUEUE_SIZE]);
+	request->token = t;
+	request->type = type;
+	request->tone = tone;
+
+	ril_dtmf.count++;
+
+	return 0;
+}
 
-	unsigned char dtmf_count = 1;
+void ril_dtmf_queue_pop(void)
+{
+	ril_dtmf.head = (ril_dtmf.head + 1) % RIL_DTMF_QUEUE_SIZE;
+	ril_dtmf.count--;
+}
+
+void ril_dtmf_sent_complete(RIL_Errno e)
+{
 	int i;
 
-	if(ril_state.dtmf_tone != 0) {
-		LOGD("Another tone wasn't stopped, stopping that one before anything");
+	for(i = 0 ; i < ril_dtmf.sent_count ; i++)
+		RIL_onRequestComplete(ril_dtmf.sent_tokens[i], e, NULL, 0);
 
-		cont_dtmf.state = IPC_CALL_DTMF_STATE_STOP;
-		cont_dtmf.tone = 0;
+	ril_dtmf.sent_count = 0;
+	ril_dtmf.busy = 0;
+}
+
+void ril_dtmf_run(void);
 
-		ipc_fmt_send(IPC_CALL_CONT_DTMF, IPC_TYPE_SET, (void *) &cont_dtmf, sizeof(cont_dtmf), reqGetId(t));
+/*
+ * Fails the message sent with the given serial if it's still unanswered
+ */
+void ril_dtmf_timeout(void *data)
+{
+	unsigned int serial = (unsigned int) (unsigned long) data;
+
+	if(!ril_dtmf.busy || ril_dtmf.sent_serial != serial)
+		return;
+
+	LOGE("No answer to the last DTMF message, giving up on it");
+
+	ril_dtmf_sent_complete(RIL_E_GENERIC_FAILURE);
+	ril_dtmf_run();
+}
+
+void ril_dtmf_sent(int type, unsigned char aseq)
+{
+	ril_dtmf.busy = 1;
+	ril_dtmf.sent_type = type;
+	ril_dtmf.sent_aseq = aseq;
+	ril_dtmf.sent_timestamp = ril_timestamp_ms();
+	ril_dtmf.sent_serial++;
+
+	if(ril_timed_callback(ril_dtmf_timeout, (void *) (unsigned long) ril_dtmf.sent_serial,
+		RIL_DTMF_TIMEOUT) < 0)
+		LOGE("Unable to schedule the DTMF timeout");
+}
 
-		usleep(300);
+int ril_dtmf_active_call(void)
+{
+	int i;
+
+	for(i = 0 ; i < RIL_CALL_LIST_MAX ; i++) {
+		if(ril_call_list.entries[i].used && ril_call_list.entries[i].call.state == RIL_CALL_ACTIVE)
+			return ril_call_list.entries[i].call.index;
 	}
 
-	burst_len = sizeof(struct ipc_call_cont_dtmf) * dtmf_count + 1;
-	burst = malloc(burst_len);
-	memset(burst, 0, burst_len);
+	return 0;
+}
+
+void ril_dtmf_burst_send(void)
+{
+	unsigned char burst[sizeof(struct ipc_call_cont_dtmf) * RIL_DTMF_BURST_MAX + 1];
+	struct ipc_call_cont_dtmf cont_dtmf;
+	struct ril_dtmf_request *request;
+	unsigned char dtmf_count = 0;
+	int burst_len;
+
+	memset(burst, 0, sizeof(burst));
+
+	// Apparently, it's possible to set multiple DTMF tones on this message
+	while(ril_dtmf.count > 0 && dtmf_count < RIL_DTMF_BURST_MAX) {
+		request = &(ril_dtmf.queue[ril_dtmf.head]);
+		if(request->type != RIL_DTMF_BURST)
+			break;
+
+		cont_dtmf.state = IPC_CALL_DTMF_STATE_START;
+		cont_dtmf.tone = request->tone;
+
+		memcpy(burst + 1 + sizeof(struct ipc_call_cont_dtmf) * dtmf_count, &cont_dtmf, sizeof(cont_dtmf));
+
+		ril_dtmf.sent_tokens[dtmf_count] = request->token;
+		dtmf_count++;
+
+		ril_dtmf_queue_pop();
+	}
 
 	burst[0] = dtmf_count;
+	burst_len = sizeof(struct ipc_call_cont_dtmf) * dtmf_count + 1;
+
+	if(dtmf_count > 1)
+		LOGD("Sending %d DTMF tones in a single burst", dtmf_count);
 
-	for(i=0 ; i < dtmf_count ; i++) {
-		// Apparently, it's possible to set multiple DTMF tones on this message
+	ril_dtmf.sent_count = dtmf_count;
+	ril_dtmf_sent(RIL_DTMF_BURST, reqGetId(ril_dtmf.sent_tokens[0]));
 
+	ipc_gen_phone_res_expect_to_func(ril_dtmf.sent_aseq, IPC_CALL_BURST_DTMF,
+		ipc_call_burst_dtmf_complete);
+
+	ipc_fmt_send(IPC_CALL_BURST_DTMF, IPC_TYPE_EXEC, (void *) burst, burst_len, ril_dtmf.sent_aseq);
+}
+
+void ril_dtmf_cont_send(RIL_Token t, int type, unsigned char tone)
+{
+	struct ipc_call_cont_dtmf cont_dtmf;
+
+	if(type == RIL_DTMF_START) {
 		cont_dtmf.state = IPC_CALL_DTMF_STATE_START;
-		cont_dtmf.tone = ((char *) data)[0];
+		cont_dtmf.tone = tone;
+
+		ril_dtmf.tone = tone;
+		ril_dtmf.tone_call = ril_dtmf_active_call();
+	} else {
+		cont_dtmf.state = IPC_CALL_DTMF_STATE_STOP;
+		cont_dtmf.tone = 0;
+
+		ril_dtmf.tone = 0;
+		ril_dtmf.tone_call = 0;
+	}
+
+	if(t != (RIL_Token) 0x00) {
+		ril_dtmf.sent_tokens[0] = t;
+		ril_dtmf.sent_count = 1;
+		ril_dtmf_sent(type, reqGetId(t));
+	} else {
+		ril_dtmf.sent_count = 0;
+		ril_dtmf_sent(type, ril_request_reg_id((RIL_Token) 0x00));
+	}
+
+	ipc_gen_phone_res_expect_to_func(ril_dtmf.sent_aseq, IPC_CALL_CONT_DTMF,
+		ipc_call_cont_dtmf_complete);
+
+	ipc_fmt_send(IPC_CALL_CONT_DTMF, IPC_TYPE_SET, (void *) &cont_dtmf, sizeof(cont_dtmf), ril_dtmf.sent_aseq);
+}
+
+void ril_dtmf_run(void)
+{
+	struct ril_dtmf_request *request;
+
+	if(ril_dtmf.busy || ril_dtmf.count == 0)
+		return;
+
+	request = &(ril_dtmf.queue[ril_dtmf.head]);
+
+	// A tone still being played has to be stopped first
+	if(request->type != RIL_DTMF_STOP && ril_dtmf.tone != 0) {
+		LOGD("Another tone wasn't stopped, stopping that one before anything");
+		ril_dtmf_cont_send((RIL_Token) 0x00, RIL_DTMF_STOP, 0);
+		return;
+	}
+
+	switch(request->type) {
+		case RIL_DTMF_BURST:
+			ril_dtmf_burst_send();
+			break;
+		case RIL_DTMF_START:
+		case RIL_DTMF_STOP:
+			ril_dtmf_queue_pop();
+			ril_dtmf_cont_send(request->token, request->type, request->tone);
+			break;
+	}
+}
+
+void ril_dtmf_run_timer(void *data)
+{
+	ril_dtmf.scheduled = 0;
+
+	ril_dtmf_run();
+}
 
-		memcpy(burst + 1 + sizeof(struct ipc_call_cont_dtmf) * i, &cont_dtmf, sizeof(cont_dtmf));
+void ril_dtmf_schedule(int delay)
+{
+	if(ril_dtmf.scheduled)
+		return;
+
+	if(ril_timed_callback(ril_dtmf_run_timer, NULL, delay) < 0) {
+		LOGE("Unable to schedule the DTMF queue, running it now");
+		ril_dtmf_run();
+		return;
 	}
 
-	ipc_gen_phone_res_expect_to_abort(reqGetId(t), IPC_CALL_BURST_DTMF);
+	ril_dtmf.scheduled = 1;
+}
+
+void ril_dtmf_next(void)
+{
+	// Give the modem some time after stopping a tone
+	if(ril_dtmf.sent_type == RIL_DTMF_STOP)
+		ril_dtmf_schedule(RIL_DTMF_STOP_DELAY);
+	else
+		ril_dtmf_run();
+}
+
+void ril_dtmf_call_status(struct ipc_call_status *call_status)
+{
+	// The tone ends with its call
+	if(call_status->state == IPC_CALL_STATE_RELEASED && ril_dtmf.tone != 0 &&
+		ril_dtmf.tone_call == call_status->id) {
+		LOGD("Call %d released, its DTMF tone is over", call_status->id);
+		ril_dtmf.tone = 0;
+		ril_dtmf.tone_call = 0;
+	}
+}
 
-	ipc_fmt_send(IPC_CALL_BURST_DTMF, IPC_TYPE_EXEC, (void *) burst, burst_len, reqGetId(t));
+/**
+ * In: RIL_REQUEST_DTMF
+ *   Send DTMF burst. RILJ only sends 1 DTMF tone to send at a time.
+ *
+ * Out: IPC_CALL_BURST_DTMF
+ *   It should be possible to send multiple DTMF tones at once in this message.
+ *   First byte should be DTMF tones count.
+ */
+void ril_request_dtmf(RIL_Token t, void *data, int length)
+{
+	if(data == NULL || length < 1 ||
+		ril_dtmf_queue_add(t, RIL_DTMF_BURST, ((unsigned char *) data)[0]) < 0) {
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
 
-	free(burst);
+	ril_dtmf_run();
 }
 
+/**
+ * In: IPC_GEN_PHONE_RES
+ *   Only fails the burst, its result is given by IPC_CALL_BURST_DTMF
+ */
+void ipc_call_burst_dtmf_complete(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
+
+	if(!ril_dtmf.busy || ril_dtmf.sent_aseq != info->aseq)
+		return;
+
+	if(ipc_gen_phone_res_check(phone_res) >= 0)
+		return;
+
+	LOGE("There was an error during DTMF burst!");
+
+	ril_dtmf_sent_complete(RIL_E_GENERIC_FAILURE);
+	ril_dtmf_next();
+}
+
+/**
+ * In: IPC_CALL_BURST_DTMF
+ *
+ * Out: RIL_REQUEST_DTMF
+ */
 void ipc_call_burst_dtmf(struct ipc_message_info *info)
 {
-	unsigned char ret = *((unsigned char *) info->data);
+	unsigned char ret;
+
+	if(!ril_dtmf.busy || ril_dtmf.sent_aseq != info->aseq) {
+		LOGE("Unexpected DTMF burst answer, ignoring");
+		return;
+	}
+
+	if(info->data == NULL || info->length < 1)
+		ret = 0;
+	else
+		ret = *((unsigned char *) info->data);
 
 	// This apparently should return 1, or perhaps that is the DTMF tones count
 	if(ret == 0) {
 		LOGD("Apparently, something went wrong with DTMF burst");
 
-		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+		ril_dtmf_sent_complete(RIL_E_GENERIC_FAILURE);
+	} else {
+		ril_dtmf_sent_complete(RIL_E_SUCCESS);
 	}
 
-	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, NULL, 0);
+	ril_dtmf_next();
 }
 
-void ril_request_dtmf_start(RIL_Token t, void *data, int length)
+/**
+ * In: IPC_GEN_PHONE_RES
+ *
+ * Out: RIL_REQUEST_DTMF_START or RIL_REQUEST_DTMF_STOP
+ */
+void ipc_call_cont_dtmf_complete(struct ipc_message_info *info)
 {
-	struct ipc_call_cont_dtmf cont_dtmf;
+	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
 
-	if(ril_state.dtmf_tone != 0) {
-		LOGD("Another tone wasn't stopped, stopping that one before anything");
+	if(!ril_dtmf.busy || ril_dtmf.sent_aseq != info->aseq)
+		return;
 
-		cont_dtmf.state = IPC_CALL_DTMF_STATE_STOP;
-		cont_dtmf.tone = 0;
+	if(ipc_gen_phone_res_check(phone_res) < 0) {
+		LOGE("There was an error during continuous DTMF!");
 
-		ipc_fmt_send(IPC_CALL_CONT_DTMF, IPC_TYPE_SET, (void *) &cont_dtmf, sizeof(cont_dtmf), reqGetId(t));
+		// Don't try to stop a tone that didn't start
+		if(ril_dtmf.sent_type == RIL_DTMF_START) {
+			ril_dtmf.tone = 0;
+			ril_dtmf.tone_call = 0;
+		}
 
-		usleep(300);
+		ril_dtmf_sent_complete(RIL_E_GENERIC_FAILURE);
+	} else {
+		ril_dtmf_sent_complete(RIL_E_SUCCESS);
 	}
 
-	cont_dtmf.state = IPC_CALL_DTMF_STATE_START;
-	cont_dtmf.tone = ((unsigned char *)data)[0];
-
-	ril_state.dtmf_tone = cont_dtmf.tone;
+	ril_dtmf_next();
+}
 
-	ipc_gen_phone_res_expect_to_complete(reqGetId(t), IPC_CALL_CONT_DTMF);
+void ril_request_dtmf_start(RIL_Token t, void *data, int length)
+{
+	if(data == NULL || length < 1 ||
+		ril_dtmf_queue_add(t, RIL_DTMF_START, ((unsigned char *) data)[0]) < 0) {
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
 
-	ipc_fmt_send(IPC_CALL_CONT_DTMF, IPC_TYPE_SET, (void *) &cont_dtmf, sizeof(cont_dtmf), reqGetId(t));
+	ril_dtmf_run();
 }
 
 void ril_request_dtmf_stop(RIL_Token t)
 {
-	struct ipc_call_cont_dtmf cont_dtmf;
-	cont_dtmf.state = IPC_CALL_DTMF_STATE_STOP;
-	cont_dtmf.tone = 0;
-
-	ril_state.dtmf_tone = 0;
-
-	ipc_gen_phone_res_expect_to_complete(reqGetId(t), IPC_CALL_CONT_DTMF);
+	if(ril_dtmf_queue_add(t, RIL_DTMF_STOP, 0) < 0) {
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
 
-	ipc_fmt_send(IPC_CALL_CONT_DTMF, IPC_TYPE_SET, (void *) &cont_dtmf, sizeof(cont_dtmf), reqGetId(t));
+	ril_dtmf_run();
 }
@@ -0,0 +1,75 @@
+/**
+ * This file is part of samsung-ril.
+ *
+ * samsung-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * samsung-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with samsung-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_DEVICE_H_
+#define _SAMSUNG_RIL_DEVICE_H_
+
+/*
+ * Device profiles, selected by Android.mk according to TARGET_DEVICE
+ * The GPRS values mirror the libsamsung-ipc device description, so that
+ * they are known at build time instead of being asked for on each setup.
+ * When a value isn't defined, it is asked to libsamsung-ipc at runtime.
+ *
+ * RIL_DEVICE_GPRS_CID_MAX: number of PDP contexts
+ * RIL_DEVICE_GPRS_PORT_LIST: whether IPC_GPRS_PORT_LIST is needed
+ * RIL_DEVICE_GPRS_IFACE: interface name format, given cid - 1
+ * RIL_DEVICE_GPRS_HANDLERS: whether the interface needs to be activated
+ * RIL_DEVICE_PWR_UP_DELAY: delay (in us) to wait for the modem once up
+ */
+
+#if defined(DEVICE_CRESPO)
+	#define RIL_DEVICE_NAME			"crespo"
+	#define RIL_DEVICE_GPRS_CID_MAX		1
+	#define RIL_DEVICE_GPRS_PORT_LIST	0
+	#define RIL_DEVICE_GPRS_IFACE		"rmnet%d"
+	#define RIL_DEVICE_GPRS_HANDLERS	0
+#elif defined(DEVICE_ARIES)
+	#define RIL_DEVICE_NAME			"aries"
+	#define RIL_DEVICE_GPRS_CID_MAX		3
+	#define RIL_DEVICE_GPRS_PORT_LIST	1
+	#define RIL_DEVICE_GPRS_IFACE		"pdp%d"
+	#define RIL_DEVICE_GPRS_HANDLERS	1
+#elif defined(DEVICE_GALAXYS2)
+	#define RIL_DEVICE_NAME			"galaxys2"
+	#define RIL_DEVICE_GPRS_CID_MAX		3
+	#define RIL_DEVICE_GPRS_PORT_LIST	0
+	#define RIL_DEVICE_GPRS_IFACE		"rmnet%d"
+	#define RIL_DEVICE_GPRS_HANDLERS	0
+#elif defined(DEVICE_MAGURO)
+	#define RIL_DEVICE_NAME			"maguro"
+	#define RIL_DEVICE_GPRS_CID_MAX		3
+	#define RIL_DEVICE_GPRS_PORT_LIST	0
+	#define RIL_DEVICE_GPRS_IFACE		"rmnet%d"
+	#define RIL_DEVICE_GPRS_HANDLERS	0
+#elif defined(DEVICE_H1)
+	#define RIL_DEVICE_NAME			"h1"
+	/* H1 baseband firmware bug workaround: wait for nvram to initialize */
+	#define RIL_DEVICE_PWR_UP_DELAY		25000
+#elif defined(DEVICE_HOST)
+	/* Host builds, for benchmarking against a fake modem */
+	#define RIL_DEVICE_NAME			"host"
+	#define RIL_DEVICE_GPRS_CID_MAX		3
+	#define RIL_DEVICE_GPRS_PORT_LIST	0
+	#define RIL_DEVICE_GPRS_IFACE		"rmnet%d"
+	#define RIL_DEVICE_GPRS_HANDLERS	0
+#else
+	#define RIL_DEVICE_NAME			"generic"
+	#define RIL_DEVICE_PWR_UP_DELAY		25000
+#endif
+
+#endif
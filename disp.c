@@ -22,9 +22,69 @@
 #define LOG_TAG "RIL-DISP"
 #include <utils/Log.h>
 
+#include <limits.h>
+
+#include <cutils/properties.h>
+
 #include "samsung-ril.h"
 #include "util.h"
 
+/**
+ * DISP global vars
+ */
+
+struct ril_signal_strength ril_signal_strength;
+
+/**
+ * IPC RSSI to GSM ASU conversion table:
+ * IPC RSSI is given in -dBm, ASU is (dBm + 113) / 2 capped to 31
+ * and RSSI values above 0x6f mean no signal.
+ */
+
+#define IPC_RSSI_ASU(r) \
+	((r) > 0x6f ? 0 : ((0x71 - (r)) / 2 > 31 ? 31 : (0x71 - (r)) / 2))
+
+#define IPC_RSSI_ASU_4(r) \
+	IPC_RSSI_ASU(r), IPC_RSSI_ASU((r) + 1), \
+	IPC_RSSI_ASU((r) + 2), IPC_RSSI_ASU((r) + 3)
+#define IPC_RSSI_ASU_16(r) \
+	IPC_RSSI_ASU_4(r), IPC_RSSI_ASU_4((r) + 4), \
+	IPC_RSSI_ASU_4((r) + 8), IPC_RSSI_ASU_4((r) + 12)
+#define IPC_RSSI_ASU_64(r) \
+	IPC_RSSI_ASU_16(r), IPC_RSSI_ASU_16((r) + 16), \
+	IPC_RSSI_ASU_16((r) + 32), IPC_RSSI_ASU_16((r) + 48)
+
+static const unsigned char ipc2ril_rssi_asu[256] = {
+	IPC_RSSI_ASU_64(0x00), IPC_RSSI_ASU_64(0x40),
+	IPC_RSSI_ASU_64(0x80), IPC_RSSI_ASU_64(0xc0),
+};
+
+/*
+ * Compile-time check that the table matches the former formula for all the
+ * 256 IPC RSSI values: the array size gets negative otherwise
+ */
+
+#define IPC_RSSI_ASU_FORMULA(r) \
+	((((r) - 0x71) * -1) - (((r) - 0x71) * -1) % 2) / 2
+#define IPC_RSSI_ASU_BASELINE(r) \
+	((r) > 0x6f ? 0 : (IPC_RSSI_ASU_FORMULA(r) > 31 ? 31 : IPC_RSSI_ASU_FORMULA(r)))
+
+#define IPC_RSSI_ASU_CHECK(r) \
+	(IPC_RSSI_ASU(r) == IPC_RSSI_ASU_BASELINE(r))
+#define IPC_RSSI_ASU_CHECK_4(r) \
+	(IPC_RSSI_ASU_CHECK(r) && IPC_RSSI_ASU_CHECK((r) + 1) && \
+	IPC_RSSI_ASU_CHECK((r) + 2) && IPC_RSSI_ASU_CHECK((r) + 3))
+#define IPC_RSSI_ASU_CHECK_16(r) \
+	(IPC_RSSI_ASU_CHECK_4(r) && IPC_RSSI_ASU_CHECK_4((r) + 4) && \
+	IPC_RSSI_ASU_CHECK_4((r) + 8) && IPC_RSSI_ASU_CHECK_4((r) + 12))
+#define IPC_RSSI_ASU_CHECK_64(r) \
+	(IPC_RSSI_ASU_CHECK_16(r) && IPC_RSSI_ASU_CHECK_16((r) + 16) && \
+	IPC_RSSI_ASU_CHECK_16((r) + 32) && IPC_RSSI_ASU_CHECK_16((r) + 48))
+
+extern char ipc2ril_rssi_asu_check[(IPC_RSSI_ASU_CHECK_64(0x00) &&
+	IPC_RSSI_ASU_CHECK_64(0x40) && IPC_RSSI_ASU_CHECK_64(0x80) &&
+	IPC_RSSI_ASU_CHECK_64(0xc0)) ? 1 : -1];
+
 /**
  * Converts IPC RSSI to Android RIL format
  */
@@ -37,17 +97,7 @@ void ipc2ril_rssi(unsigned char rssi, RIL_SignalStrength *ss)
 		return;
 	}
 
-	memset(ss, 0, sizeof(ss));
-
-	if(rssi > 0x6f) {
-		ril_rssi = 0;
-	} else {
-		ril_rssi = (((rssi - 0x71) * -1) - ((rssi - 0x71) * -1) % 2) / 2;
-		if(ril_rssi > 31)
-			ril_rssi = 31;
-	}
-
-	LOGD("Signal Strength is %d\n", ril_rssi);
+	ril_rssi = ipc2ril_rssi_asu[rssi];
 
 	ss->GW_SignalStrength.signalStrength = ril_rssi;
 	ss->GW_SignalStrength.bitErrorRate = 99;
@@ -58,12 +108,210 @@ void ipc2ril_rssi(unsigned char rssi, RIL_SignalStrength *ss)
 
 	ss->EVDO_SignalStrength.dbm = ril_rssi;
 	ss->EVDO_SignalStrength.ecio = 200;
+	ss->EVDO_SignalStrength.signalNoiseRatio = -1;
+
+#if RIL_VERSION >= 6
+	/* No LTE support: report all the LTE values as invalid */
+	ss->LTE_SignalStrength.signalStrength = 99;
+	ss->LTE_SignalStrength.rsrp = INT_MAX;
+	ss->LTE_SignalStrength.rsrq = INT_MAX;
+	ss->LTE_SignalStrength.rssnr = INT_MAX;
+	ss->LTE_SignalStrength.cqi = INT_MAX;
+#endif
 }
 
+/**
+ * Converts GSM ASU to dBm
+ */
+int ril_asu2dbm(int asu)
+{
+	if(asu < 0 || asu > 31)
+		return -113;
+
+	return -113 + 2 * asu;
+}
+
+/**
+ * Returns the signal bar level (0 to 4) for GSM ASU, as computed by Android
+ */
+int ril_asu2level(int asu)
+{
+	if(asu <= 2 || asu == 99)
+		return 0;
+	else if(asu >= 12)
+		return 4;
+	else if(asu >= 8)
+		return 3;
+	else if(asu >= 5)
+		return 2;
+	else
+		return 1;
+}
+
+/**
+ * Signal strength cache:
+ * The last signal strength is kept and used to answer RIL_REQUEST_SIGNAL_STRENGTH.
+ * Unsolicited reports are only forwarded when the bar level changes, when the
+ * level moves by more than the hysteresis (in dBm) or when the value changed
+ * and the last report is older than the max interval (in ms).
+ * Both can be tuned with the ril.signal.* system properties.
+ */
+
+void ril_signal_strength_init(void)
+{
+	char prop[PROPERTY_VALUE_MAX];
+
+	memset(&ril_signal_strength, 0, sizeof(struct ril_signal_strength));
+
+	property_get(RIL_SIGNAL_STRENGTH_HYSTERESIS_PROPERTY, prop, "");
+	if(prop[0] != '\0')
+		ril_signal_strength.hysteresis = atoi(prop);
+	else
+		ril_signal_strength.hysteresis = RIL_SIGNAL_STRENGTH_HYSTERESIS;
+
+	property_get(RIL_SIGNAL_STRENGTH_INTERVAL_MAX_PROPERTY, prop, "");
+	if(prop[0] != '\0')
+		ril_signal_strength.interval_max = atoi(prop);
+	else
+		ril_signal_strength.interval_max = RIL_SIGNAL_STRENGTH_INTERVAL_MAX;
+}
+
+/**
+ * Returns 1 if the new signal strength is worth an unsolicited report
+ */
+int ril_signal_strength_report_needed(RIL_SignalStrength *ss)
+{
+	int asu = ss->GW_SignalStrength.signalStrength;
+	int reported_asu = ril_signal_strength.reported_ss.GW_SignalStrength.signalStrength;
+	int dbm_delta;
+
+	if(ril_signal_strength.reported_timestamp == 0)
+		return 1;
+
+	if(asu == reported_asu)
+		return 0;
+
+	if(ril_asu2level(asu) != ril_asu2level(reported_asu))
+		return 1;
+
+	dbm_delta = ril_asu2dbm(asu) - ril_asu2dbm(reported_asu);
+	if(dbm_delta < 0)
+		dbm_delta = -dbm_delta;
+
+	if(dbm_delta >= ril_signal_strength.hysteresis)
+		return 1;
+
+	if(ril_timestamp_ms() - ril_signal_strength.reported_timestamp >= ril_signal_strength.interval_max)
+		return 1;
+
+	return 0;
+}
+
+void ril_signal_strength_report(RIL_SignalStrength *ss)
+{
+	LOGD("Reporting signal strength (%d suppressed since last report, %d/%d total)",
+		ril_signal_strength.suppressed_count, ril_signal_strength.suppressed_count_total,
+		ril_signal_strength.reported_count + ril_signal_strength.suppressed_count_total);
+
+	memcpy(&ril_signal_strength.reported_ss, ss, sizeof(RIL_SignalStrength));
+	ril_signal_strength.reported_timestamp = ril_timestamp_ms();
+	ril_signal_strength.reported_count++;
+	ril_signal_strength.suppressed_count = 0;
+	ril_signal_strength.pending = 0;
+
+	RIL_onUnsolicitedResponse(RIL_UNSOL_SIGNAL_STRENGTH, ss, sizeof(RIL_SignalStrength));
+}
+
+void ril_signal_strength_schedule(void);
+
+/*
+ * Changes held back by the hysteresis are reported at most interval_max
+ * after the last report, even if the modem doesn't notify anything else
+ */
+void ril_signal_strength_timer(void *data)
+{
+	ril_signal_strength.scheduled = 0;
+
+	if(!ril_signal_strength.pending || ril_screen_state_off())
+		return;
+
+	// Something was reported since, wait for the rest of the interval
+	if(ril_timestamp_ms() - ril_signal_strength.reported_timestamp < ril_signal_strength.interval_max) {
+		ril_signal_strength_schedule();
+		return;
+	}
+
+	ril_signal_strength_flush();
+}
+
+void ril_signal_strength_schedule(void)
+{
+	long long delay;
+
+	if(ril_signal_strength.scheduled || ril_signal_strength.interval_max <= 0)
+		return;
+
+	delay = ril_signal_strength.interval_max -
+		(ril_timestamp_ms() - ril_signal_strength.reported_timestamp);
+	if(delay < 0)
+		delay = 0;
+
+	if(ril_timed_callback(ril_signal_strength_timer, NULL, (int) delay) == 0)
+		ril_signal_strength.scheduled = 1;
+}
+
+/**
+ * Updates the cached signal strength and reports it to RILJ if needed
+ */
+void ril_signal_strength_update(RIL_SignalStrength *ss)
+{
+	memcpy(&ril_signal_strength.ss, ss, sizeof(RIL_SignalStrength));
+	ril_signal_strength.valid = 1;
+
+	if(ril_screen_state_off() || !ril_signal_strength_report_needed(ss)) {
+		// Keep track of the changes that were never reported
+		ril_signal_strength.pending = (ss->GW_SignalStrength.signalStrength !=
+			ril_signal_strength.reported_ss.GW_SignalStrength.signalStrength);
+
+		// Reported on screen on otherwise
+		if(ril_signal_strength.pending && !ril_screen_state_off())
+			ril_signal_strength_schedule();
+
+		ril_signal_strength.suppressed_count++;
+		ril_signal_strength.suppressed_count_total++;
+		return;
+	}
+
+	ril_signal_strength_report(ss);
+}
+
+/**
+ * Reports the cached signal strength if it changed since the last report
+ */
+void ril_signal_strength_flush(void)
+{
+	if(!ril_signal_strength.valid || !ril_signal_strength.pending)
+		return;
+
+	ril_signal_strength_report(&ril_signal_strength.ss);
+}
+
+/**
+ * In: RIL_REQUEST_SIGNAL_STRENGTH
+ *   Return the cached signal strength if known
+ *
+ * Out: IPC_DISP_ICON_INFO
+ *   Ask the modem otherwise
+ */
 void ril_request_signal_strength(RIL_Token t)
 {
 	unsigned char request = 1;
 
+	if(ril_signal_strength.valid) {
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, &ril_signal_strength.ss, sizeof(RIL_SignalStrength));
+		return;
+	}
+
 	ipc_fmt_send(IPC_DISP_ICON_INFO, IPC_TYPE_GET, &request, sizeof(request), reqGetId(t));
 }
 
@@ -88,9 +336,12 @@ void ipc_disp_icon_info(struct ipc_message_info *info)
 
 	if(info->type == IPC_TYPE_NOTI) {
 		LOGD("Unsol request!");
-		RIL_onUnsolicitedResponse(RIL_UNSOL_SIGNAL_STRENGTH, &ss, sizeof(ss));
+		ril_signal_strength_update(&ss);
 	} else if(info->type == IPC_TYPE_RESP) {
 		LOGD("Sol request!");
+		memcpy(&ril_signal_strength.ss, &ss, sizeof(RIL_SignalStrength));
+		ril_signal_strength.valid = 1;
+
 		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, &ss, sizeof(ss));
 	}
 }
@@ -118,5 +369,5 @@ void ipc_disp_rssi_info(struct ipc_message_info *info)
 
 	ipc2ril_rssi(rssi_info->rssi, &ss);
 
-	RIL_onUnsolicitedResponse(RIL_UNSOL_SIGNAL_STRENGTH, &ss, sizeof(ss));
+	ril_signal_strength_update(&ss);
 }
@@ -21,20 +21,81 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #define LOG_TAG "RIL-GPRS"
 #include <utils/Log.h>
 #include <cutils/properties.h>
 
-#if RIL_VERSION >= 6
-#include <netutils/ifc.h>
-#endif
-
 #include "samsung-ril.h"
 #include "util.h"
+#include "netlink.h"
 
-struct ril_gprs_connection **ril_gprs_connections;
+/*
+ * Device specific GPRS features are known at build time for most devices,
+ * see device.h: libsamsung-ipc is only asked for them otherwise
+ */
+
+#ifdef RIL_DEVICE_GPRS_PORT_LIST
+#define ril_gprs_port_list_supported()	RIL_DEVICE_GPRS_PORT_LIST
+#else
+#define ril_gprs_port_list_supported()	(ril_gprs_capabilities_get()->port_list)
+#endif
+
+#ifdef RIL_DEVICE_GPRS_HANDLERS
+#define ril_gprs_handlers_available(ipc_client)	RIL_DEVICE_GPRS_HANDLERS
+#else
+#define ril_gprs_handlers_available(ipc_client)	ipc_client_gprs_handlers_available(ipc_client)
+#endif
+
+/**
+ * GPRS global vars
+ */
+
+struct ril_gprs_connection ril_gprs_connections[RIL_GPRS_CONNECTIONS_MAX];
 int ril_gprs_connections_count;
+unsigned char ril_gprs_connections_aseq[0x100];
+
+RIL_Data_Call_Response ril_data_call_list[RIL_GPRS_CONNECTIONS_MAX];
+struct ril_gprs_data_call_strings ril_data_call_list_strings[RIL_GPRS_CONNECTIONS_MAX];
+int ril_data_call_list_count;
+int ril_data_call_list_dirty;
+int ril_data_call_list_pending;
+long long ril_data_call_list_timestamp;
+
+int ril_data_call_list_scheduled;
+int ril_data_call_list_changed;
+int ril_data_call_list_reconcile_needed;
+int ril_data_call_list_sent_valid;
+int ril_data_call_list_sent_count;
+int ril_data_call_list_sent_cids[RIL_GPRS_CONNECTIONS_MAX];
+struct ril_gprs_data_call_strings ril_data_call_list_sent_strings[RIL_GPRS_CONNECTIONS_MAX];
+
+struct ipc_client_gprs_capabilities ril_gprs_capabilities;
+int ril_gprs_capabilities_valid;
+
+unsigned int ril_gprs_generation;
+
+struct ril_gprs_defined_context ril_gprs_defined_contexts[RIL_GPRS_CONNECTIONS_MAX];
+int ril_gprs_port_list_done;
+
+// Only ever used from the GPRS worker thread
+int ril_gprs_activated[RIL_GPRS_CONNECTIONS_MAX];
+int ril_gprs_activated_count;
+
+// Setup latency stats are kept for the whole lifetime of the RIL
+struct srs_data_call_stats ril_gprs_setup_stats;
+struct srs_data_call_stats ril_gprs_setup_stats_apn[RIL_GPRS_SETUP_STATS_APN_MAX];
+int ril_gprs_setup_stats_apn_count;
+
+int ril_gprs_traffic_sampling;
+unsigned int ril_gprs_traffic_generation;
+
+struct ril_gprs_job *ril_gprs_jobs;
+pthread_mutex_t ril_gprs_jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ril_gprs_jobs_cond = PTHREAD_COND_INITIALIZER;
+pthread_t ril_gprs_worker_thread;
+int ril_gprs_worker_started;
 
 RIL_LastDataCallActivateFailCause ipc2ril_gprs_fail_cause(unsigned short fail_cause)
 {
@@ -78,111 +139,566 @@ int ipc2ril_gprs_connection_active(unsigned char state)
 	}
 }
 
-void ril_gprs_connections_init(void)
+/**
+ * GPRS setup latency stats:
+ * Each setup stage is timestamped on the connection when it ends. Once the
+ * interface is configured, the stage durations are added to histograms, for
+ * all the APNs and for the connection APN.
+ */
+
+static const unsigned int ril_gprs_histogram_bounds[SRS_DATA_CALL_HISTOGRAM_BUCKETS - 1] = {
+	10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+
+static const char *ril_gprs_stage_names[SRS_DATA_CALL_STAGE_COUNT] = {
+	"port list", "define", "activate", "ip configuration",
+	"call status", "interface", "properties", "total"
+};
+
+void ril_gprs_stage_mark(struct ril_gprs_connection *gprs_connection,
+	enum srs_data_call_stage stage)
 {
-	struct ipc_client_gprs_capabilities gprs_capabilities;
-	struct ipc_client *ipc_client;
-	int ril_gprs_connections_size = 0;
+	gprs_connection->stage_timestamps[stage] = ril_timestamp_ms();
+}
 
-	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
-	ipc_client_gprs_get_capabilities(ipc_client, &gprs_capabilities);
+void ril_gprs_histogram_add(struct srs_data_call_histogram *histogram,
+	unsigned int duration)
+{
+	int i;
+
+	for(i=0 ; i < SRS_DATA_CALL_HISTOGRAM_BUCKETS - 1 ; i++) {
+		if(duration <= ril_gprs_histogram_bounds[i])
+			break;
+	}
 
-	ril_gprs_connections_size =
-		gprs_capabilities.cid_max * sizeof(struct ril_gprs_connection *);
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->total_ms += duration;
+
+	if(duration > histogram->max_ms)
+		histogram->max_ms = duration;
+}
+
+struct srs_data_call_stats *ril_gprs_setup_stats_apn_get(char *apn)
+{
+	struct srs_data_call_stats *stats;
+	int i;
+
+	for(i=0 ; i < ril_gprs_setup_stats_apn_count ; i++) {
+		if(strncmp(ril_gprs_setup_stats_apn[i].apn, apn, SRS_DATA_CALL_APN_LEN) == 0)
+			return &ril_gprs_setup_stats_apn[i];
+	}
+
+	if(ril_gprs_setup_stats_apn_count >= RIL_GPRS_SETUP_STATS_APN_MAX)
+		return NULL;
+
+	stats = &ril_gprs_setup_stats_apn[ril_gprs_setup_stats_apn_count++];
+	strncpy(stats->apn, apn, SRS_DATA_CALL_APN_LEN - 1);
+
+	return stats;
+}
+
+void ril_gprs_setup_stats_add(struct ril_gprs_connection *gprs_connection)
+{
+	struct srs_data_call_stats *stats_apn;
+	unsigned int durations[SRS_DATA_CALL_STAGE_COUNT];
+	long long previous;
+	long long timestamp;
+	char *apn;
+	int i;
+
+	apn = (char *) gprs_connection->define_context.apn;
+	stats_apn = ril_gprs_setup_stats_apn_get(apn);
+
+	previous = gprs_connection->setup_timestamp;
+
+	for(i=0 ; i < SRS_DATA_CALL_STAGE_TOTAL ; i++) {
+		timestamp = gprs_connection->stage_timestamps[i];
+		durations[i] = 0;
+
+		// Skipped stage (e.g. already defined context)
+		if(timestamp == 0)
+			continue;
+
+		// Modem messages may come in a slightly different order
+		if(timestamp > previous) {
+			durations[i] = timestamp - previous;
+			previous = timestamp;
+		}
+
+		ril_gprs_histogram_add(&ril_gprs_setup_stats.stages[i], durations[i]);
+		if(stats_apn != NULL)
+			ril_gprs_histogram_add(&(stats_apn->stages[i]), durations[i]);
+	}
+
+	durations[SRS_DATA_CALL_STAGE_TOTAL] = previous - gprs_connection->setup_timestamp;
+
+	ril_gprs_histogram_add(&ril_gprs_setup_stats.stages[SRS_DATA_CALL_STAGE_TOTAL],
+		durations[SRS_DATA_CALL_STAGE_TOTAL]);
+	if(stats_apn != NULL)
+		ril_gprs_histogram_add(&(stats_apn->stages[SRS_DATA_CALL_STAGE_TOTAL]),
+			durations[SRS_DATA_CALL_STAGE_TOTAL]);
+
+	if(durations[SRS_DATA_CALL_STAGE_TOTAL] < RIL_GPRS_SETUP_SLOW)
+		return;
+
+	LOGE("Slow data call setup to APN '%s' for cid %d: %ums",
+		apn, gprs_connection->cid, durations[SRS_DATA_CALL_STAGE_TOTAL]);
+
+	for(i=0 ; i < SRS_DATA_CALL_STAGE_TOTAL ; i++) {
+		if(gprs_connection->stage_timestamps[i] != 0)
+			LOGE("\t%s: %ums", ril_gprs_stage_names[i], durations[i]);
+	}
+}
+
+void ril_gprs_setup_stats_log(struct srs_data_call_stats *stats)
+{
+	struct srs_data_call_histogram *histogram;
+	int i;
+
+	LOGD("Data call setup stats for APN '%s':", stats->apn);
+
+	for(i=0 ; i < SRS_DATA_CALL_STAGE_COUNT ; i++) {
+		histogram = &(stats->stages[i]);
+		if(histogram->count == 0)
+			continue;
+
+		LOGD("\t%s: count=%u avg=%ums max=%ums", ril_gprs_stage_names[i],
+			histogram->count, histogram->total_ms / histogram->count,
+			histogram->max_ms);
+	}
+}
+
+/**
+ * In: SRS_CONTROL_DATA_CALL_STATS
+ *   Send back the setup stats for the given APN, or for all of them
+ */
+void srs_control_data_call_stats(int fd, struct srs_message *message)
+{
+	struct srs_data_call_stats *stats = &ril_gprs_setup_stats;
+	char apn[SRS_DATA_CALL_APN_LEN];
+	int i;
+
+	memset(apn, 0, sizeof(apn));
+
+	if(message->data != NULL && message->data_len > 0) {
+		memcpy(apn, message->data, message->data_len < SRS_DATA_CALL_APN_LEN ?
+			message->data_len : SRS_DATA_CALL_APN_LEN - 1);
+
+		stats = NULL;
+		for(i=0 ; i < ril_gprs_setup_stats_apn_count ; i++) {
+			if(strncmp(ril_gprs_setup_stats_apn[i].apn, apn, SRS_DATA_CALL_APN_LEN) == 0)
+				stats = &ril_gprs_setup_stats_apn[i];
+		}
+
+		if(stats == NULL) {
+			LOGE("No data call setup stats for APN '%s'", apn);
+			srs_server_send(fd, SRS_CONTROL_DATA_CALL_STATS, NULL, 0);
+			return;
+		}
+	}
+
+	ril_gprs_setup_stats_log(stats);
+
+	srs_server_send(fd, SRS_CONTROL_DATA_CALL_STATS, stats,
+		sizeof(struct srs_data_call_stats));
+}
+
+/**
+ * GPRS traffic monitor:
+ * The counters of the interfaces of the enabled connections are sampled
+ * periodically, as long as there is at least one of them. A connection is
+ * considered stalled when packets keep being sent without anything received
+ * for a while: the modem is then asked for its PDP contexts, so that a
+ * connection it dropped silently gets reported.
+ */
+
+void ril_gprs_traffic_update(struct ril_gprs_connection *gprs_connection,
+	struct ril_netlink_stats *stats, long long timestamp)
+{
+	struct ril_gprs_traffic *traffic = &(gprs_connection->traffic);
+	int stalled = 0;
+
+	if(traffic->timestamp == 0 || stats->rx_packets != traffic->stats.rx_packets) {
+		if(traffic->stalled)
+			LOGD("Traffic is flowing again on %s", gprs_connection->interface);
+
+		traffic->rx_timestamp = timestamp;
+		traffic->rx_tx_packets = stats->tx_packets;
+		traffic->stalled = 0;
+	} else if(!traffic->stalled &&
+		timestamp - traffic->rx_timestamp >= RIL_GPRS_STALL_WINDOW &&
+		stats->tx_packets - traffic->rx_tx_packets >= RIL_GPRS_STALL_TX_PACKETS) {
+		LOGE("Data stall on %s: %llu packets sent and nothing received for %llds",
+			gprs_connection->interface, stats->tx_packets - traffic->rx_tx_packets,
+			(timestamp - traffic->rx_timestamp) / 1000);
+
+		traffic->stalled = 1;
+		stalled = 1;
+	}
 
-	ril_gprs_connections = (struct ril_gprs_connection **)
-		malloc(ril_gprs_connections_size);
-	memset((void *) ril_gprs_connections, 0, ril_gprs_connections_size);
+	memcpy(&(traffic->stats), stats, sizeof(struct ril_netlink_stats));
+	traffic->timestamp = timestamp;
 
-	ril_gprs_connections_count = gprs_capabilities.cid_max;
+	if(stalled)
+		ril_data_call_list_reconcile();
 }
 
-int ril_gprs_connection_reg_id(void)
+void ril_gprs_traffic_sample(void *data)
 {
 	struct ril_gprs_connection *gprs_connection;
+	struct ril_netlink_stats stats;
+	long long timestamp;
+	int active = 0;
+	int rc;
 	int i;
 
+	if(!ril_gprs_traffic_sampling ||
+		(unsigned int) (unsigned long) data != ril_gprs_traffic_generation)
+		return;
+
+	timestamp = ril_timestamp_ms();
+
 	for(i=0 ; i < ril_gprs_connections_count ; i++) {
-		if(ril_gprs_connections[i] == NULL)
-			return i;
+		gprs_connection = &ril_gprs_connections[i];
+
+		if(gprs_connection->state != RIL_GPRS_CONNECTION_ENABLED)
+			continue;
+
+		active++;
+
+		rc = ril_netlink_iface_stats(gprs_connection->interface, &stats);
+		if(rc < 0) {
+			LOGE("Failed to read %s counters: %s",
+				gprs_connection->interface, strerror(-rc));
+			continue;
+		}
+
+		ril_gprs_traffic_update(gprs_connection, &stats, timestamp);
 	}
 
-	LOGD("No room left for another GPRS connection, trying to clean one up");
+	if(!active) {
+		ril_gprs_traffic_sampling = 0;
+		return;
+	}
+
+	if(ril_timed_callback(ril_gprs_traffic_sample, data, RIL_GPRS_TRAFFIC_INTERVAL) < 0)
+		ril_gprs_traffic_sampling = 0;
+}
+
+void ril_gprs_traffic_start(void)
+{
+	void *data;
+
+	if(ril_gprs_traffic_sampling)
+		return;
+
+	ril_gprs_traffic_generation++;
+	data = (void *) (unsigned long) ril_gprs_traffic_generation;
+
+	if(ril_timed_callback(ril_gprs_traffic_sample, data, RIL_GPRS_TRAFFIC_INTERVAL) < 0) {
+		LOGE("Failed to start GPRS traffic monitor");
+		return;
+	}
+
+	ril_gprs_traffic_sampling = 1;
+}
+
+/**
+ * In: SRS_CONTROL_DATA_CALL_TRAFFIC
+ *   Send back the last traffic sample of each enabled connection
+ */
+void srs_control_data_call_traffic(int fd, struct srs_message *message)
+{
+	struct srs_data_call_traffic traffic[RIL_GPRS_CONNECTIONS_MAX];
+	struct ril_gprs_connection *gprs_connection;
+	long long timestamp;
+	int count = 0;
+	int i;
+
+	memset(traffic, 0, sizeof(traffic));
+	timestamp = ril_timestamp_ms();
 
-	// When all the slots are taken, see if some are in a non-working state
 	for(i=0 ; i < ril_gprs_connections_count ; i++) {
-		if(ril_gprs_connections[i]->enabled == 0) {
-			ril_gprs_connection_del(ril_gprs_connections[i]);
+		gprs_connection = &ril_gprs_connections[i];
+
+		if(gprs_connection->state != RIL_GPRS_CONNECTION_ENABLED)
+			continue;
+
+		traffic[count].cid = gprs_connection->cid;
+		strncpy(traffic[count].ifname, gprs_connection->interface,
+			sizeof(traffic[count].ifname) - 1);
+		traffic[count].rx_bytes = gprs_connection->traffic.stats.rx_bytes;
+		traffic[count].tx_bytes = gprs_connection->traffic.stats.tx_bytes;
+		traffic[count].rx_packets = gprs_connection->traffic.stats.rx_packets;
+		traffic[count].tx_packets = gprs_connection->traffic.stats.tx_packets;
+		traffic[count].stalled = gprs_connection->traffic.stalled;
+
+		if(gprs_connection->traffic.timestamp != 0)
+			traffic[count].rx_idle_ms =
+				timestamp - gprs_connection->traffic.rx_timestamp;
+
+		count++;
+	}
+
+	srs_server_send(fd, SRS_CONTROL_DATA_CALL_TRAFFIC, traffic,
+		count * sizeof(struct srs_data_call_traffic));
+}
+
+/**
+ * GPRS connections table:
+ * Connections live in a fixed array indexed by cid - 1, so that a connection
+ * handle stays valid for the whole lifetime of the RIL. Requests sent for a
+ * connection register their aseq in ril_gprs_connections_aseq, so that the
+ * matching connection is found directly from the modem answer.
+ */
+
+void ril_gprs_connections_init(void)
+{
+	struct ril_gprs_connection *gprs_connection;
+	int i;
 
-			return i;
+	// The modem is not going to answer anymore
+	for(i=0 ; i < RIL_GPRS_CONNECTIONS_MAX ; i++) {
+		gprs_connection = &ril_gprs_connections[i];
+
+		switch(gprs_connection->state) {
+			case RIL_GPRS_CONNECTION_SETUP:
+			case RIL_GPRS_CONNECTION_CONFIGURING:
+				if(gprs_connection->token != (RIL_Token) 0x00)
+					RIL_onRequestComplete(gprs_connection->token,
+						RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+				break;
+			case RIL_GPRS_CONNECTION_TEARDOWN:
+				if(gprs_connection->teardown_token != (RIL_Token) 0x00)
+					RIL_onRequestComplete(gprs_connection->teardown_token,
+						RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+				break;
+			default:
+				break;
 		}
 	}
 
-	return -1;
+	// Jobs already queued for these connections are dropped by the worker
+	ril_gprs_generation++;
+
+	memset(ril_gprs_connections, 0, sizeof(ril_gprs_connections));
+	memset(ril_gprs_connections_aseq, 0, sizeof(ril_gprs_connections_aseq));
+
+	// Capabilities are only asked for when needed
+	ril_gprs_connections_count = 0;
+	ril_gprs_capabilities_valid = 0;
+
+	// The modem forgets about defined contexts when powered off
+	ril_gprs_contexts_invalidate();
+
+	ril_data_call_list_pending = 0;
+	ril_data_call_list_dirty = 1;
+	ril_data_call_list_timestamp = 0;
+	ril_data_call_list_changed = 0;
+	ril_data_call_list_reconcile_needed = 0;
+	ril_data_call_list_sent_valid = 0;
+
+	// A pending sample from before is dropped as its generation is too old
+	ril_gprs_traffic_sampling = 0;
+}
+
+struct ipc_client_gprs_capabilities *ril_gprs_capabilities_get(void)
+{
+#ifndef RIL_DEVICE_GPRS_CID_MAX
+	struct ipc_client *ipc_client;
+#endif
+
+	if(ril_gprs_capabilities_valid)
+		return &ril_gprs_capabilities;
+
+#ifdef RIL_DEVICE_GPRS_CID_MAX
+	ril_gprs_capabilities.port_list = RIL_DEVICE_GPRS_PORT_LIST;
+	ril_gprs_capabilities.cid_max = RIL_DEVICE_GPRS_CID_MAX;
+#else
+	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
+	ipc_client_gprs_get_capabilities(ipc_client, &ril_gprs_capabilities);
+#endif
+
+	ril_gprs_connections_count = ril_gprs_capabilities.cid_max;
+	if(ril_gprs_connections_count > RIL_GPRS_CONNECTIONS_MAX) {
+		LOGE("Only %d GPRS connections out of %d are supported",
+			RIL_GPRS_CONNECTIONS_MAX, ril_gprs_connections_count);
+		ril_gprs_connections_count = RIL_GPRS_CONNECTIONS_MAX;
+	}
+
+	ril_gprs_capabilities_valid = 1;
+
+	return &ril_gprs_capabilities;
 }
 
-struct ril_gprs_connection *ril_gprs_connection_add(void)
+struct ril_gprs_connection *ril_gprs_connection_add(char *apn)
 {
 	struct ril_gprs_connection *gprs_connection = NULL;
-	int id = ril_gprs_connection_reg_id();
+	int i;
+
+	ril_gprs_capabilities_get();
+
+	// Prefer a cid that already has a context defined for this APN
+	for(i=0 ; apn != NULL && i < ril_gprs_connections_count ; i++) {
+		if(ril_gprs_connections[i].state == RIL_GPRS_CONNECTION_FREE &&
+			ril_gprs_defined_contexts[i].valid &&
+			strncmp((char *) ril_gprs_defined_contexts[i].define_context.apn, apn,
+			sizeof(ril_gprs_defined_contexts[i].define_context.apn)) == 0) {
+			gprs_connection = &ril_gprs_connections[i];
+			break;
+		}
+	}
+
+	for(i=0 ; gprs_connection == NULL && i < ril_gprs_connections_count ; i++) {
+		if(ril_gprs_connections[i].state == RIL_GPRS_CONNECTION_FREE) {
+			gprs_connection = &ril_gprs_connections[i];
+			break;
+		}
+	}
 
-	if(id < 0) {
+	if(gprs_connection == NULL) {
+		LOGD("No room left for another GPRS connection, trying to clean one up");
+
+		// When all the slots are taken, see if some are in a non-working state
+		for(i=0 ; i < ril_gprs_connections_count ; i++) {
+			if(ril_gprs_connections[i].state == RIL_GPRS_CONNECTION_FAILED) {
+				gprs_connection = &ril_gprs_connections[i];
+				break;
+			}
+		}
+	}
+
+	if(gprs_connection == NULL) {
 		LOGE("Unable to add another GPRS connection!");
 		return NULL;
 	}
 
-	gprs_connection = malloc(sizeof(struct ril_gprs_connection));
+	i = gprs_connection - ril_gprs_connections;
+
 	memset(gprs_connection, 0, sizeof(struct ril_gprs_connection));
 
-	gprs_connection->cid = id + 1;
-	gprs_connection->enabled = 0;
-	gprs_connection->interface = NULL;
+	gprs_connection->cid = i + 1;
+	gprs_connection->state = RIL_GPRS_CONNECTION_SETUP;
 	gprs_connection->token = (RIL_Token) 0x00;
-
-	ril_gprs_connections[id] = gprs_connection;
+	gprs_connection->generation = ++ril_gprs_generation;
 
 	return gprs_connection;
 }
 
 void ril_gprs_connection_del(struct ril_gprs_connection *gprs_connection)
 {
-	int i;
+	if(gprs_connection == NULL)
+		return;
+
+	if(gprs_connection->state == RIL_GPRS_CONNECTION_ENABLED ||
+		gprs_connection->state == RIL_GPRS_CONNECTION_TEARDOWN)
+		ril_data_call_list_invalidate();
+
+	memset(gprs_connection, 0, sizeof(struct ril_gprs_connection));
+	gprs_connection->state = RIL_GPRS_CONNECTION_FREE;
+}
+
+struct ril_gprs_connection *ril_gprs_connection_get_cid(int cid)
+{
+	if(cid < 1 || cid > ril_gprs_connections_count)
+		return NULL;
+
+	if(ril_gprs_connections[cid - 1].state == RIL_GPRS_CONNECTION_FREE)
+		return NULL;
+
+	return &ril_gprs_connections[cid - 1];
+}
+
+/**
+ * Registers the aseq of a request sent on behalf of the GPRS connection
+ */
+void ril_gprs_connection_reg_aseq(struct ril_gprs_connection *gprs_connection, int aseq)
+{
+	ril_gprs_connections_aseq[aseq & 0xff] = gprs_connection->cid;
+}
 
+struct ril_gprs_connection *ril_gprs_connection_get_aseq(int aseq)
+{
+	struct ril_gprs_connection *gprs_connection;
+
+	gprs_connection = ril_gprs_connection_get_cid(ril_gprs_connections_aseq[aseq & 0xff]);
 	if(gprs_connection == NULL)
+		return NULL;
+
+	// The aseq may have been reused since
+	if(gprs_connection->token != reqGetToken(aseq) &&
+		gprs_connection->teardown_token != reqGetToken(aseq))
+		return NULL;
+
+	return gprs_connection;
+}
+
+/**
+ * Defined PDP contexts cache:
+ * The modem keeps PDP contexts defined once for a cid, as well as the port
+ * list, until it is powered off. When reconnecting to the same APN on the
+ * same cid, the definition is skipped and the context is activated right away.
+ * Credentials are sent along with the activation, so they are not part of it.
+ */
+
+void ril_gprs_contexts_invalidate(void)
+{
+	memset(ril_gprs_defined_contexts, 0, sizeof(ril_gprs_defined_contexts));
+	ril_gprs_port_list_done = 0;
+}
+
+void ril_gprs_context_invalidate(int cid)
+{
+	if(cid < 1 || cid > RIL_GPRS_CONNECTIONS_MAX)
 		return;
 
-	if(gprs_connection->interface != NULL)
-		free(gprs_connection->interface);
+	ril_gprs_defined_contexts[cid - 1].valid = 0;
+}
+
+int ril_gprs_context_defined(struct ril_gprs_connection *gprs_connection)
+{
+	struct ril_gprs_defined_context *defined_context;
+
+	defined_context = &ril_gprs_defined_contexts[gprs_connection->cid - 1];
 
-	for(i=0 ; i < ril_gprs_connections_count ; i++)
-		if(ril_gprs_connections[i] == gprs_connection)
-				ril_gprs_connections[i] = NULL;
+	if(!defined_context->valid)
+		return 0;
 
-	free(gprs_connection);
+	return memcmp(&(defined_context->define_context), &(gprs_connection->define_context),
+		sizeof(struct ipc_gprs_define_pdp_context)) == 0;
 }
 
-struct ril_gprs_connection *ril_gprs_connection_get_token(RIL_Token token)
+/*
+ * Only gives a connection still being set up with the token of this aseq
+ */
+struct ril_gprs_connection *ril_gprs_connection_setup_get_aseq(int aseq)
 {
-	int i;
+	struct ril_gprs_connection *gprs_connection;
 
-	for(i=0 ; i < ril_gprs_connections_count ; i++)
-		if(ril_gprs_connections[i] != NULL)
-			if(ril_gprs_connections[i]->token == token)
-				return ril_gprs_connections[i];
+	gprs_connection = ril_gprs_connection_get_aseq(aseq);
+	if(gprs_connection == NULL)
+		return NULL;
 
-	return NULL;
+	if(gprs_connection->token == (RIL_Token) 0x00 ||
+		gprs_connection->token != reqGetToken(aseq))
+		return NULL;
+
+	return gprs_connection;
 }
 
-struct ril_gprs_connection *ril_gprs_connection_get_cid(int cid)
+void ril_gprs_connection_setup_fail(struct ril_gprs_connection *gprs_connection, int aseq)
 {
-	int i;
+	gprs_connection->state = RIL_GPRS_CONNECTION_FAILED;
+	gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
+	gprs_connection->token = (RIL_Token) 0x00;
+	ril_state.gprs_last_failed_cid = gprs_connection->cid;
 
-	for(i=0 ; i < ril_gprs_connections_count ; i++)
-		if(ril_gprs_connections[i] != NULL)
-			if(ril_gprs_connections[i]->cid == cid)
-				return ril_gprs_connections[i];
+	// Don't trust the context definition anymore
+	ril_gprs_context_invalidate(gprs_connection->cid);
 
-	return NULL;
+	RIL_onRequestComplete(reqGetToken(aseq),
+		RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ipc_gprs_pdp_context_enable_complete(struct ipc_message_info *info)
@@ -191,13 +707,11 @@ void ipc_gprs_pdp_context_enable_complete(struct ipc_message_info *info)
 	struct ril_gprs_connection *gprs_connection;
 	int rc;
 
-	gprs_connection = ril_gprs_connection_get_token(reqGetToken(info->aseq));
+	gprs_connection = ril_gprs_connection_setup_get_aseq(info->aseq);
 
+	// The setup token was already completed when the setup was aborted
 	if(!gprs_connection) {
-		LOGE("Unable to find GPRS connection, aborting");
-
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		LOGD("No GPRS connection setup for aseq 0x%x, ignoring", info->aseq);
 		return;
 	}
 
@@ -205,32 +719,40 @@ void ipc_gprs_pdp_context_enable_complete(struct ipc_message_info *info)
 	if(rc < 0) {
 		LOGE("There was an error, aborting PDP context complete");
 
-		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
-		gprs_connection->token = (RIL_Token) 0x00;
-		ril_state.gprs_last_failed_cid = gprs_connection->cid;
-
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		ril_gprs_connection_setup_fail(gprs_connection, info->aseq);
 		return;
 	}
 
+	ril_gprs_stage_mark(gprs_connection, SRS_DATA_CALL_STAGE_ACTIVATE);
+
 	LOGD("Waiting for IP configuration!");
 }
 
+void ril_gprs_connection_activate_send(struct ril_gprs_connection *gprs_connection, int aseq)
+{
+	ril_gprs_connection_reg_aseq(gprs_connection, aseq);
+
+	ipc_gen_phone_res_expect_to_func(aseq, IPC_GPRS_PDP_CONTEXT,
+		ipc_gprs_pdp_context_enable_complete);
+
+	ipc_fmt_send(IPC_GPRS_PDP_CONTEXT, IPC_TYPE_SET,
+			(void *) &(gprs_connection->context),
+			sizeof(struct ipc_gprs_pdp_context_set), aseq);
+}
+
 void ipc_gprs_define_pdp_context_complete(struct ipc_message_info *info)
 {
 	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
 	struct ril_gprs_connection *gprs_connection;
+	struct ril_gprs_defined_context *defined_context;
 	int aseq;
 	int rc;
 
-	gprs_connection = ril_gprs_connection_get_token(reqGetToken(info->aseq));
+	gprs_connection = ril_gprs_connection_setup_get_aseq(info->aseq);
 
+	// The setup token was already completed when the setup was aborted
 	if(!gprs_connection) {
-		LOGE("Unable to find GPRS connection, aborting");
-
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		LOGD("No GPRS connection setup for aseq 0x%x, ignoring", info->aseq);
 		return;
 	}
 
@@ -238,24 +760,42 @@ void ipc_gprs_define_pdp_context_complete(struct ipc_message_info *info)
 	if(rc < 0) {
 		LOGE("There was an error, aborting define PDP context complete");
 
-		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
-		gprs_connection->token = (RIL_Token) 0x00;
-		ril_state.gprs_last_failed_cid = gprs_connection->cid;
-
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		ril_gprs_connection_setup_fail(gprs_connection, info->aseq);
 		return;
 	}
 
+	defined_context = &ril_gprs_defined_contexts[gprs_connection->cid - 1];
+	memcpy(&(defined_context->define_context), &(gprs_connection->define_context),
+		sizeof(struct ipc_gprs_define_pdp_context));
+	defined_context->valid = 1;
+
+	ril_gprs_stage_mark(gprs_connection, SRS_DATA_CALL_STAGE_DEFINE);
+
 	// We need to get a clean new aseq here
 	aseq = ril_request_reg_id(reqGetToken(info->aseq));
 
-	ipc_gen_phone_res_expect_to_func(aseq, IPC_GPRS_PDP_CONTEXT,
-		ipc_gprs_pdp_context_enable_complete);
+	ril_gprs_connection_activate_send(gprs_connection, aseq);
+}
 
-	ipc_fmt_send(IPC_GPRS_PDP_CONTEXT, IPC_TYPE_SET,
-			(void *) &(gprs_connection->context),
-			sizeof(struct ipc_gprs_pdp_context_set), aseq);
+void ril_gprs_connection_define_send(struct ril_gprs_connection *gprs_connection, int aseq)
+{
+	if(ril_gprs_context_defined(gprs_connection)) {
+		LOGD("PDP context already defined for cid %d, activating it",
+			gprs_connection->cid);
+
+		ril_gprs_connection_activate_send(gprs_connection, aseq);
+		return;
+	}
+
+	ril_gprs_connection_reg_aseq(gprs_connection, aseq);
+
+	ipc_gen_phone_res_expect_to_func(aseq, IPC_GPRS_DEFINE_PDP_CONTEXT,
+		ipc_gprs_define_pdp_context_complete);
+
+	ipc_fmt_send(IPC_GPRS_DEFINE_PDP_CONTEXT, IPC_TYPE_SET,
+		(void *) &(gprs_connection->define_context),
+		sizeof(struct ipc_gprs_define_pdp_context),
+		aseq);
 }
 
 void ipc_gprs_port_list_complete(struct ipc_message_info *info)
@@ -265,13 +805,11 @@ void ipc_gprs_port_list_complete(struct ipc_message_info *info)
 	int rc;
 	int aseq;
 
-	gprs_connection = ril_gprs_connection_get_token(reqGetToken(info->aseq));
+	gprs_connection = ril_gprs_connection_setup_get_aseq(info->aseq);
 
+	// The setup token was already completed when the setup was aborted
 	if(!gprs_connection) {
-		LOGE("Unable to find GPRS connection, aborting");
-
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		LOGD("No GPRS connection setup for aseq 0x%x, ignoring", info->aseq);
 		return;
 	}
 
@@ -279,47 +817,35 @@ void ipc_gprs_port_list_complete(struct ipc_message_info *info)
 	if(rc < 0) {
 		LOGE("There was an error, aborting port list complete");
 
-		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
-		gprs_connection->token = (RIL_Token) 0x00;
-		ril_state.gprs_last_failed_cid = gprs_connection->cid;
-
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		ril_gprs_connection_setup_fail(gprs_connection, info->aseq);
 		return;
 	}
 
+	ril_gprs_port_list_done = 1;
+	ril_gprs_stage_mark(gprs_connection, SRS_DATA_CALL_STAGE_PORT_LIST);
+
 	// We need to get a clean new aseq here
 	aseq = ril_request_reg_id(reqGetToken(info->aseq));
 
-	ipc_gen_phone_res_expect_to_func(aseq, IPC_GPRS_DEFINE_PDP_CONTEXT,
-		ipc_gprs_define_pdp_context_complete);
-
-	ipc_fmt_send(IPC_GPRS_DEFINE_PDP_CONTEXT, IPC_TYPE_SET,
-		(void *) &(gprs_connection->define_context),
-		sizeof(struct ipc_gprs_define_pdp_context),
-		aseq);
+	ril_gprs_connection_define_send(gprs_connection, aseq);
 }
 
 void ril_request_setup_data_call(RIL_Token t, void *data, int length)
 {
 	struct ril_gprs_connection *gprs_connection = NULL;
-	struct ipc_client_gprs_capabilities gprs_capabilities;
 	struct ipc_gprs_port_list port_list;
-	struct ipc_client *ipc_client;
 
 	char *username = NULL;
 	char *password = NULL;
 	char *apn = NULL;
 
-	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
-
 	apn = ((char **) data)[2];
 	username = ((char **) data)[3];
 	password = ((char **) data)[4];
 
 	LOGD("Requesting data connection to APN '%s'\n", apn);
 
-	gprs_connection = ril_gprs_connection_add();
+	gprs_connection = ril_gprs_connection_add(apn);
 
 	if(!gprs_connection) {
 		LOGE("Unable to create GPRS connection, aborting");
@@ -330,6 +856,10 @@ void ril_request_setup_data_call(RIL_Token t, void *data, int length)
 
 	gprs_connection->token = t;
 
+	gprs_connection->setup_timestamp = ril_timestamp_ms();
+	memset(gprs_connection->stage_timestamps, 0,
+		sizeof(gprs_connection->stage_timestamps));
+
 	// Create the structs with the apn
 	ipc_gprs_define_pdp_context_setup(&(gprs_connection->define_context),
 		gprs_connection->cid, 1, apn);
@@ -338,24 +868,19 @@ void ril_request_setup_data_call(RIL_Token t, void *data, int length)
 	ipc_gprs_pdp_context_setup(&(gprs_connection->context),
 		gprs_connection->cid, 1, username, password);
 
-	ipc_client_gprs_get_capabilities(ipc_client, &gprs_capabilities);
-
-	// If the device has the capability, deal with port list
-	if(gprs_capabilities.port_list) {
+	// If the device has the capability, deal with port list once
+	if(ril_gprs_port_list_supported() && !ril_gprs_port_list_done) {
 		ipc_gprs_port_list_setup(&port_list);
 
+		ril_gprs_connection_reg_aseq(gprs_connection, reqGetId(t));
+
 		ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_GPRS_PORT_LIST,
 			ipc_gprs_port_list_complete);
 
 		ipc_fmt_send(IPC_GPRS_PORT_LIST, IPC_TYPE_SET,
 			(void *) &port_list, sizeof(struct ipc_gprs_port_list), reqGetId(t));
 	} else {
-		ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_GPRS_DEFINE_PDP_CONTEXT,
-			ipc_gprs_define_pdp_context_complete);
-
-		ipc_fmt_send(IPC_GPRS_DEFINE_PDP_CONTEXT, IPC_TYPE_SET,
-			(void *) &(gprs_connection->define_context),
-				sizeof(struct ipc_gprs_define_pdp_context), reqGetId(t));
+		ril_gprs_connection_define_send(gprs_connection, reqGetId(t));
 	}
 }
 
@@ -365,22 +890,26 @@ void ipc_gprs_ip_configuration(struct ipc_message_info *info)
         struct ipc_gprs_ip_configuration *ip_configuration =
 		(struct ipc_gprs_ip_configuration *) info->data;
 
-	gprs_connection = ril_gprs_connection_get_cid(ip_configuration->cid);
+	if(info->data == NULL || info->length < sizeof(struct ipc_gprs_ip_configuration))
+		return;
 
-	if(!gprs_connection) {
-		LOGE("Unable to find GPRS connection, aborting");
+	gprs_connection = ril_gprs_connection_get_cid(ip_configuration->cid);
 
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+	// This is a notification: there is no request to complete here
+	if(!gprs_connection || gprs_connection->state != RIL_GPRS_CONNECTION_SETUP) {
+		LOGE("Unexpected IP configuration for cid %d, ignoring",
+			ip_configuration->cid);
 		return;
 	}
 
-	LOGD("Obtained IP Configuration");
+	LOGD("Obtained IP Configuration for cid %d", gprs_connection->cid);
 
 	// Copy the obtained IP configuration to the GPRS connection structure
 	memcpy(&(gprs_connection->ip_configuration),
 		ip_configuration, sizeof(struct ipc_gprs_ip_configuration));
 
+	ril_gprs_stage_mark(gprs_connection, SRS_DATA_CALL_STAGE_IP_CONFIGURATION);
+
 	LOGD("Waiting for GPRS call status");
 }
 
@@ -390,13 +919,10 @@ void ipc_gprs_pdp_context_disable_complete(struct ipc_message_info *info)
 	struct ril_gprs_connection *gprs_connection;
 	int rc;
 
-	gprs_connection = ril_gprs_connection_get_token(reqGetToken(info->aseq));
-
-	if(!gprs_connection) {
-		LOGE("Unable to find GPRS connection, aborting");
+	gprs_connection = ril_gprs_connection_get_aseq(info->aseq);
 
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+	if(!gprs_connection || gprs_connection->teardown_token != reqGetToken(info->aseq)) {
+		LOGD("No GPRS connection teardown for aseq 0x%x, ignoring", info->aseq);
 		return;
 	}
 
@@ -432,20 +958,125 @@ void ril_request_deactivate_data_call(RIL_Token t, void *data, int length)
 		return;
 	}
 
-	gprs_connection->token = t;
+	switch(gprs_connection->state) {
+		case RIL_GPRS_CONNECTION_TEARDOWN:
+			LOGE("GPRS connection with cid %d is already being deactivated",
+				gprs_connection->cid);
+
+			RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+			return;
+		case RIL_GPRS_CONNECTION_FAILED:
+			ril_gprs_connection_del(gprs_connection);
+
+			RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+			return;
+		case RIL_GPRS_CONNECTION_SETUP:
+		case RIL_GPRS_CONNECTION_CONFIGURING:
+			LOGD("Aborting GPRS connection setup with cid %d", gprs_connection->cid);
+
+			RIL_onRequestComplete(gprs_connection->token,
+				RIL_E_GENERIC_FAILURE, NULL, 0);
+			gprs_connection->token = (RIL_Token) 0x00;
+			break;
+		default:
+			break;
+	}
+
+	gprs_connection->state = RIL_GPRS_CONNECTION_TEARDOWN;
+	gprs_connection->teardown_token = t;
+	ril_gprs_connection_reg_aseq(gprs_connection, reqGetId(t));
 
 	ipc_gprs_pdp_context_setup(&context, gprs_connection->cid, 0, NULL, NULL);
 
 	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_GPRS_PDP_CONTEXT,
 		ipc_gprs_pdp_context_disable_complete);
 
-	ipc_fmt_send(IPC_GPRS_PDP_CONTEXT, IPC_TYPE_SET,
-		(void *) &context, sizeof(struct ipc_gprs_pdp_context_set), reqGetId(t));
+	ipc_fmt_send(IPC_GPRS_PDP_CONTEXT, IPC_TYPE_SET,
+		(void *) &context, sizeof(struct ipc_gprs_pdp_context_set), reqGetId(t));
+}
+
+/**
+ * The GPRS handlers of the IPC client are shared by all the connections:
+ * only activate them for the first connection and deactivate them after
+ * the last one is gone.
+ */
+void ril_gprs_activate(int cid)
+{
+	struct ipc_client *ipc_client;
+	int rc;
+
+	if(cid < 1 || cid > RIL_GPRS_CONNECTIONS_MAX || ril_gprs_activated[cid - 1])
+		return;
+
+	ril_gprs_activated[cid - 1] = 1;
+	ril_gprs_activated_count++;
+
+	if(ril_gprs_activated_count > 1)
+		return;
+
+	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
+
+	if(ril_gprs_handlers_available(ipc_client)) {
+		rc = ipc_client_gprs_activate(ipc_client);
+		if(rc < 0) {
+			// This is not a critical issue
+			LOGE("Failed to activate interface!");
+		}
+	}
+}
+
+void ril_gprs_deactivate(int cid)
+{
+	struct ipc_client *ipc_client;
+	int rc;
+
+	if(cid < 1 || cid > RIL_GPRS_CONNECTIONS_MAX || !ril_gprs_activated[cid - 1])
+		return;
+
+	ril_gprs_activated[cid - 1] = 0;
+	ril_gprs_activated_count--;
+
+	if(ril_gprs_activated_count > 0)
+		return;
+
+	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
+
+	if(ril_gprs_handlers_available(ipc_client)) {
+		rc = ipc_client_gprs_deactivate(ipc_client);
+		if(rc < 0) {
+			// This is not a critical issue
+			LOGE("Failed to deactivate interface!");
+		}
+	}
+}
+
+char *ril_gprs_interface_get(struct ipc_client *ipc_client, int cid)
+{
+	char *interface = NULL;
+
+#ifdef RIL_DEVICE_GPRS_IFACE
+	asprintf(&interface, RIL_DEVICE_GPRS_IFACE, cid - 1);
+#else
+	int rc;
+
+	rc = ipc_client_gprs_get_iface(ipc_client, &interface, cid);
+	if(rc < 0) {
+		// This is not a critical issue, fallback to rmnet
+		LOGE("Failed to get interface name!");
+		asprintf(&interface, "rmnet%d", cid - 1);
+	}
+#endif
+
+	return interface;
 }
 
-int ipc_gprs_connection_enable(struct ril_gprs_connection *gprs_connection,
-	RIL_Data_Call_Response *setup_data_call_response)
+/**
+ * Brings the network interface up and configures it
+ * This is called from the GPRS worker thread, without the RIL lock held
+ */
+int ipc_gprs_connection_enable(struct ril_gprs_job *job)
 {
+	RIL_Data_Call_Response *setup_data_call_response = &(job->setup_data_call_response);
 	struct ipc_client *ipc_client;
         struct ipc_gprs_ip_configuration *ip_configuration;
 
@@ -462,7 +1093,7 @@ int ipc_gprs_connection_enable(struct ril_gprs_connection *gprs_connection,
 
 	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
 
-	ip_configuration = &(gprs_connection->ip_configuration);
+	ip_configuration = &(job->ip_configuration);
 
 	asprintf(&ip, "%i.%i.%i.%i",
 		(ip_configuration->ip)[0],
@@ -490,24 +1121,12 @@ int ipc_gprs_connection_enable(struct ril_gprs_connection *gprs_connection,
 		(ip_configuration->dns2)[2],
 		(ip_configuration->dns2)[3]);	
 
-	if(ipc_client_gprs_handlers_available(ipc_client)) {
-		rc = ipc_client_gprs_activate(ipc_client);
-		if(rc < 0) {
-			// This is not a critical issue
-			LOGE("Failed to activate interface!");
-		}
-	}
+	ril_gprs_activate(job->cid);
 
-	rc = ipc_client_gprs_get_iface(ipc_client, &interface, gprs_connection->cid);
-	if(rc < 0) {
-		// This is not a critical issue, fallback to rmnet
-		LOGE("Failed to get interface name!");
-		asprintf(&interface, "rmnet%d", gprs_connection->cid - 1);
-	}
+	interface = ril_gprs_interface_get(ipc_client, job->cid);
 
-	if(gprs_connection->interface == NULL && interface != NULL) {
-		gprs_connection->interface = strdup(interface);
-	}
+	if(interface != NULL)
+		strncpy(job->interface, interface, RIL_GPRS_INTERFACE_LEN - 1);
 
 	LOGD("Using net interface: %s\n", interface);
 
@@ -515,23 +1134,26 @@ int ipc_gprs_connection_enable(struct ril_gprs_connection *gprs_connection,
 			"gateway:%s, subnet_mask:%s, dns1:%s, dns2:%s",
 		interface, ip, gateway, subnet_mask, dns1, dns2);
 
-	int subnet_addr = inet_addr(subnet_mask);
-	#if RIL_VERSION >= 6
-		subnet_addr = ipv4NetmaskToPrefixLength(subnet_addr);
-	#endif
-
-	rc = ifc_configure(interface, inet_addr(ip),
-		subnet_addr,
-		inet_addr(gateway),
-		inet_addr(dns1), inet_addr(dns2));
+	rc = ril_netlink_iface_configure(interface, inet_addr(ip),
+		ril_netlink_prefix_length(inet_addr(subnet_mask)),
+		inet_addr(gateway));
 
 	if(rc < 0) {
-		LOGE("ifc_configure failed");
+		LOGE("Interface configuration failed: %s", strerror(-rc));
+
+		ril_gprs_deactivate(job->cid);
 
 		free(interface);
+		free(ip);
+		free(gateway);
+		free(subnet_mask);
+		free(dns1);
+		free(dns2);
 		return -1;
 	}
 
+	job->interface_timestamp = ril_timestamp_ms();
+
 	snprintf(prop_name, PROPERTY_KEY_MAX, "net.%s.dns1", interface);
 	property_set(prop_name, dns1);
 	snprintf(prop_name, PROPERTY_KEY_MAX, "net.%s.dns2", interface);
@@ -539,7 +1161,9 @@ int ipc_gprs_connection_enable(struct ril_gprs_connection *gprs_connection,
 	snprintf(prop_name, PROPERTY_KEY_MAX, "net.%s.gw", interface);
 	property_set(prop_name, gateway);
 
-	setup_data_call_response->cid = gprs_connection->cid;
+	job->properties_timestamp = ril_timestamp_ms();
+
+	setup_data_call_response->cid = job->cid;
 	setup_data_call_response->active = 1;
 	setup_data_call_response->type = strdup("IP");
 
@@ -561,7 +1185,11 @@ int ipc_gprs_connection_enable(struct ril_gprs_connection *gprs_connection,
 	return 0;
 }
 
-int ipc_gprs_connection_disable(struct ril_gprs_connection *gprs_connection)
+/**
+ * Brings the network interface down
+ * This is called from the GPRS worker thread, without the RIL lock held
+ */
+int ipc_gprs_connection_disable(struct ril_gprs_job *job)
 {
 	struct ipc_client *ipc_client;
 
@@ -570,35 +1198,24 @@ int ipc_gprs_connection_disable(struct ril_gprs_connection *gprs_connection)
 
 	ipc_client = ((struct ipc_client_object *) ipc_fmt_client->object)->ipc_client;
 
-	if(gprs_connection->interface == NULL) {
-		rc = ipc_client_gprs_get_iface(ipc_client, &interface, gprs_connection->cid);
-		if(rc < 0) {
-			// This is not a critical issue, fallback to rmnet
-			LOGE("Failed to get interface name!");
-			asprintf(&interface, "rmnet%d", gprs_connection->cid);
-		}
+	if(job->interface[0] == '\0') {
+		interface = ril_gprs_interface_get(ipc_client, job->cid);
 	} else {
-		interface = gprs_connection->interface;
+		interface = job->interface;
 	}
 
 	LOGD("Using net interface: %s\n", interface);
 
-	rc = ifc_down(interface);
+	rc = ril_netlink_iface_down(interface);
 
-	if(gprs_connection->interface == NULL)
+	if(job->interface[0] == '\0')
 		free(interface);
 
 	if(rc < 0) {
-		LOGE("ifc_down failed");
+		LOGE("Interface teardown failed: %s", strerror(-rc));
 	}
 
-	if(ipc_client_gprs_handlers_available(ipc_client)) {
-		rc = ipc_client_gprs_deactivate(ipc_client);
-		if(rc < 0) {
-			// This is not a critical issue
-			LOGE("Failed to deactivate interface!");
-		}
-	}
+	ril_gprs_deactivate(job->cid);
 
 	return 0;
 }
@@ -619,126 +1236,326 @@ static void cleanup_ril_data_call_response(RIL_Data_Call_Response *response) {
 #endif
 }
 
+/**
+ * GPRS worker:
+ * Configuring the network interface involves netlink and property service
+ * round-trips that must not be done with the RIL lock held, as it would hold
+ * back every other modem message meanwhile. These are queued as jobs and run
+ * in order by a dedicated thread, that reports back to the GPRS connection
+ * state machine with the RIL lock held. The connection generation is used to
+ * detect connections that were dropped or reused in the meantime.
+ */
+
+void ril_gprs_job_complete(struct ril_gprs_job *job);
+
+void *ril_gprs_worker(void *data)
+{
+	struct ril_gprs_job *job;
+
+	while(1) {
+		pthread_mutex_lock(&ril_gprs_jobs_mutex);
+
+		while(ril_gprs_jobs == NULL)
+			pthread_cond_wait(&ril_gprs_jobs_cond, &ril_gprs_jobs_mutex);
+
+		job = ril_gprs_jobs;
+		ril_gprs_jobs = job->next;
+
+		pthread_mutex_unlock(&ril_gprs_jobs_mutex);
+
+		switch(job->type) {
+			case RIL_GPRS_JOB_ENABLE:
+				job->rc = ipc_gprs_connection_enable(job);
+				break;
+			case RIL_GPRS_JOB_DISABLE:
+				job->rc = ipc_gprs_connection_disable(job);
+				break;
+		}
+
+		ril_lock();
+		ril_gprs_job_complete(job);
+		ril_unlock();
+
+		cleanup_ril_data_call_response(&(job->setup_data_call_response));
+		free(job);
+	}
+
+	return NULL;
+}
+
+int ril_gprs_worker_start(void)
+{
+	pthread_attr_t attr;
+	int rc;
+
+	if(ril_gprs_worker_started)
+		return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	rc = pthread_create(&ril_gprs_worker_thread, &attr, ril_gprs_worker, NULL);
+
+	if(rc != 0) {
+		LOGE("GPRS worker pthread creation failed");
+		return -1;
+	}
+
+	ril_gprs_worker_started = 1;
+
+	return 0;
+}
+
+int ril_gprs_job_push(struct ril_gprs_job *job)
+{
+	struct ril_gprs_job **job_last;
+	int rc;
+
+	rc = ril_gprs_worker_start();
+	if(rc < 0) {
+		free(job);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ril_gprs_jobs_mutex);
+
+	// Jobs are run in order, so that a teardown always comes before a reuse
+	job_last = &ril_gprs_jobs;
+	while(*job_last != NULL)
+		job_last = &((*job_last)->next);
+	*job_last = job;
+
+	pthread_cond_signal(&ril_gprs_jobs_cond);
+	pthread_mutex_unlock(&ril_gprs_jobs_mutex);
+
+	return 0;
+}
+
+/**
+ * Queues an interface job for the GPRS connection
+ */
+int ril_gprs_job_queue(struct ril_gprs_connection *gprs_connection, ril_gprs_job_type type)
+{
+	struct ril_gprs_job *job;
+
+	job = calloc(1, sizeof(struct ril_gprs_job));
+	if(job == NULL)
+		return -1;
+
+	job->type = type;
+	job->cid = gprs_connection->cid;
+	job->generation = gprs_connection->generation;
+
+	memcpy(&(job->ip_configuration), &(gprs_connection->ip_configuration),
+		sizeof(struct ipc_gprs_ip_configuration));
+	memcpy(job->interface, gprs_connection->interface, RIL_GPRS_INTERFACE_LEN);
+
+	return ril_gprs_job_push(job);
+}
+
+void ril_gprs_job_enable_complete(struct ril_gprs_job *job)
+{
+	struct ril_gprs_connection *gprs_connection;
+	struct ril_gprs_job *teardown_job;
+
+	gprs_connection = ril_gprs_connection_get_cid(job->cid);
+
+	if(gprs_connection == NULL || gprs_connection->generation != job->generation ||
+		gprs_connection->state != RIL_GPRS_CONNECTION_CONFIGURING) {
+		LOGE("GPRS connection with cid %d is gone, dropping its interface", job->cid);
+
+		if(job->rc >= 0) {
+			teardown_job = calloc(1, sizeof(struct ril_gprs_job));
+			if(teardown_job == NULL)
+				return;
+
+			teardown_job->type = RIL_GPRS_JOB_DISABLE;
+			teardown_job->cid = job->cid;
+			memcpy(teardown_job->interface, job->interface, RIL_GPRS_INTERFACE_LEN);
+
+			if(ril_gprs_job_push(teardown_job) < 0)
+				LOGE("Failed to queue GPRS interface teardown");
+		}
+		return;
+	}
+
+	if(job->rc < 0) {
+		LOGE("Failed to enable and configure GPRS interface");
+
+		gprs_connection->state = RIL_GPRS_CONNECTION_FAILED;
+		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
+		ril_state.gprs_last_failed_cid = gprs_connection->cid;
+
+		RIL_onRequestComplete(gprs_connection->token,
+			RIL_E_GENERIC_FAILURE, NULL, 0);
+		gprs_connection->token = (RIL_Token) 0x00;
+		return;
+	}
+
+	LOGD("GPRS interface enabled");
+
+	memcpy(gprs_connection->interface, job->interface, RIL_GPRS_INTERFACE_LEN);
+	gprs_connection->state = RIL_GPRS_CONNECTION_ENABLED;
+	ril_data_call_list_invalidate();
+
+	gprs_connection->stage_timestamps[SRS_DATA_CALL_STAGE_INTERFACE] =
+		job->interface_timestamp;
+	gprs_connection->stage_timestamps[SRS_DATA_CALL_STAGE_PROPERTIES] =
+		job->properties_timestamp;
+	ril_gprs_setup_stats_add(gprs_connection);
+
+	memset(&(gprs_connection->traffic), 0, sizeof(struct ril_gprs_traffic));
+	ril_gprs_traffic_start();
+
+	RIL_onRequestComplete(gprs_connection->token,
+		RIL_E_SUCCESS, &(job->setup_data_call_response),
+		sizeof(RIL_Data_Call_Response));
+	gprs_connection->token = (RIL_Token) 0x00;
+}
+
+void ril_gprs_job_disable_complete(struct ril_gprs_job *job)
+{
+	struct ril_gprs_connection *gprs_connection;
+
+	if(job->rc < 0)
+		LOGE("Failed to disable GPRS interface");
+	else
+		LOGD("GPRS interface disabled");
+
+	gprs_connection = ril_gprs_connection_get_cid(job->cid);
+
+	// Connections that got disabled by the modem are already gone
+	if(gprs_connection == NULL || gprs_connection->generation != job->generation ||
+		gprs_connection->state != RIL_GPRS_CONNECTION_TEARDOWN)
+		return;
+
+	RIL_onRequestComplete(gprs_connection->teardown_token,
+		job->rc < 0 ? RIL_E_GENERIC_FAILURE : RIL_E_SUCCESS, NULL, 0);
+
+	// RILJ is not going to ask for fail reason
+	ril_gprs_connection_del(gprs_connection);
+}
+
+void ril_gprs_job_complete(struct ril_gprs_job *job)
+{
+	switch(job->type) {
+		case RIL_GPRS_JOB_ENABLE:
+			ril_gprs_job_enable_complete(job);
+			break;
+		case RIL_GPRS_JOB_DISABLE:
+			ril_gprs_job_disable_complete(job);
+			break;
+	}
+}
+
 void ipc_gprs_call_status(struct ipc_message_info *info)
 {
 	struct ril_gprs_connection *gprs_connection;
 	struct ipc_gprs_call_status *call_status =
 		(struct ipc_gprs_call_status *) info->data;
 
-	RIL_Data_Call_Response setup_data_call_response;
-	memset(&setup_data_call_response, 0, sizeof(setup_data_call_response));
 	int rc;
 
+	if(info->data == NULL || info->length < sizeof(struct ipc_gprs_call_status))
+		return;
+
 	gprs_connection = ril_gprs_connection_get_cid(call_status->cid);
 
+	// This is a notification: there is no request to complete here
 	if(!gprs_connection) {
-		LOGE("Unable to find GPRS connection, aborting");
+		LOGE("Call status for unknown cid %d, reconciling", call_status->cid);
 
-		RIL_onRequestComplete(reqGetToken(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
+		ril_data_call_list_reconcile();
 		return;
 	}
 
 	if(call_status->fail_cause == 0) {
-		if(!gprs_connection->enabled &&
-			call_status->state == IPC_GPRS_STATE_ENABLED &&
-			gprs_connection->token != (RIL_Token) 0x00) {
+		if(gprs_connection->state == RIL_GPRS_CONNECTION_SETUP &&
+			call_status->state == IPC_GPRS_STATE_ENABLED) {
 			LOGD("GPRS connection is now enabled");
 
-			rc = ipc_gprs_connection_enable(gprs_connection,
-				&setup_data_call_response);
+			gprs_connection->state = RIL_GPRS_CONNECTION_CONFIGURING;
+			ril_gprs_stage_mark(gprs_connection, SRS_DATA_CALL_STAGE_CALL_STATUS);
+
+			rc = ril_gprs_job_queue(gprs_connection, RIL_GPRS_JOB_ENABLE);
 			if(rc < 0) {
-				LOGE("Failed to enable and configure GPRS interface");
+				LOGE("Failed to queue GPRS interface configuration");
 
-				gprs_connection->enabled = 0;
+				gprs_connection->state = RIL_GPRS_CONNECTION_FAILED;
 				gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
 				ril_state.gprs_last_failed_cid = gprs_connection->cid;
 
 				RIL_onRequestComplete(gprs_connection->token,
 					RIL_E_GENERIC_FAILURE, NULL, 0);
-			} else {
-				LOGD("GPRS interface enabled");
-
-				gprs_connection->enabled = 1;
-
-				RIL_onRequestComplete(gprs_connection->token,
-					RIL_E_SUCCESS, &setup_data_call_response,
-					sizeof(setup_data_call_response));
 				gprs_connection->token = (RIL_Token) 0x00;
 			}
-			cleanup_ril_data_call_response(&setup_data_call_response);
-		} else if(gprs_connection->enabled &&
-			call_status->state == IPC_GPRS_STATE_DISABLED &&
-			gprs_connection->token != (RIL_Token) 0x00) {
+		} else if(gprs_connection->state == RIL_GPRS_CONNECTION_TEARDOWN &&
+			call_status->state == IPC_GPRS_STATE_DISABLED) {
 			LOGD("GPRS connection is now disabled");
 
-			rc = ipc_gprs_connection_disable(gprs_connection);
+			rc = ril_gprs_job_queue(gprs_connection, RIL_GPRS_JOB_DISABLE);
 			if(rc < 0) {
-				LOGE("Failed to disable GPRS interface");
+				LOGE("Failed to queue GPRS interface teardown");
 
-				RIL_onRequestComplete(gprs_connection->token,
+				RIL_onRequestComplete(gprs_connection->teardown_token,
 					RIL_E_GENERIC_FAILURE, NULL, 0);
 
 				// RILJ is not going to ask for fail reason
 				ril_gprs_connection_del(gprs_connection);
-			} else {
-				LOGD("GPRS interface disabled");
-
-				gprs_connection->enabled = 0;
-
-				RIL_onRequestComplete(gprs_connection->token,
-					RIL_E_SUCCESS, NULL, 0);
-
-				ril_gprs_connection_del(gprs_connection);
 			}
 		} else {
 			LOGE("GPRS connection reported as changed though state is not OK:"
-			"\n\tgprs_connection->enabled=%d\n\tgprs_connection->token=0x%x",
-				gprs_connection->enabled, (unsigned)gprs_connection->token);
+			"\n\tgprs_connection->state=%d\n\tgprs_connection->token=0x%x",
+				gprs_connection->state, (unsigned)gprs_connection->token);
 
-			ril_unsol_data_call_list_changed();
+			ril_data_call_list_reconcile();
 		}
 	} else {
-		if(!gprs_connection->enabled &&
+		if(gprs_connection->state == RIL_GPRS_CONNECTION_SETUP &&
 			(call_status->state == IPC_GPRS_STATE_NOT_ENABLED ||
-			call_status->state == IPC_GPRS_STATE_DISABLED) &&
-			gprs_connection->token != (RIL_Token) 0x00) {
+			call_status->state == IPC_GPRS_STATE_DISABLED)) {
 			LOGE("Failed to enable GPRS connection");
 
-			gprs_connection->enabled = 0;
+			gprs_connection->state = RIL_GPRS_CONNECTION_FAILED;
 			gprs_connection->fail_cause =
 				ipc2ril_gprs_fail_cause(call_status->fail_cause);
 			ril_state.gprs_last_failed_cid = gprs_connection->cid;
+			ril_gprs_context_invalidate(gprs_connection->cid);
 
 			RIL_onRequestComplete(gprs_connection->token,
 				RIL_E_GENERIC_FAILURE, NULL, 0);
 			gprs_connection->token = (RIL_Token) 0x00;
 
 			ril_unsol_data_call_list_changed();
-		} else if(gprs_connection->enabled &&
+		} else if((gprs_connection->state == RIL_GPRS_CONNECTION_CONFIGURING ||
+			gprs_connection->state == RIL_GPRS_CONNECTION_ENABLED ||
+			gprs_connection->state == RIL_GPRS_CONNECTION_TEARDOWN) &&
 			call_status->state == IPC_GPRS_STATE_DISABLED) {
 			LOGE("GPRS connection suddently got disabled");
 
-			rc = ipc_gprs_connection_disable(gprs_connection);
-			if(rc < 0) {
-				LOGE("Failed to disable GPRS interface");
+			// Queued after a pending configuration, if any
+			rc = ril_gprs_job_queue(gprs_connection, RIL_GPRS_JOB_DISABLE);
+			if(rc < 0)
+				LOGE("Failed to queue GPRS interface teardown");
 
-				// RILJ is not going to ask for fail reason
-				ril_gprs_connection_del(gprs_connection);
-			} else {
-				LOGE("GPRS interface disabled");
+			// A pending request is not going to succeed anymore
+			if(gprs_connection->state == RIL_GPRS_CONNECTION_CONFIGURING)
+				RIL_onRequestComplete(gprs_connection->token,
+					RIL_E_GENERIC_FAILURE, NULL, 0);
+			else if(gprs_connection->state == RIL_GPRS_CONNECTION_TEARDOWN)
+				RIL_onRequestComplete(gprs_connection->teardown_token,
+					RIL_E_SUCCESS, NULL, 0);
 
-				gprs_connection->enabled = 0;
-				ril_gprs_connection_del(gprs_connection);
-			}
+			// RILJ is not going to ask for fail reason
+			ril_gprs_connection_del(gprs_connection);
 
 			ril_unsol_data_call_list_changed();
 		} else {
 			LOGE("GPRS connection reported to have failed though state is OK:"
-			"\n\tgprs_connection->enabled=%d\n\tgprs_connection->token=0x%x",
-				gprs_connection->enabled, (unsigned)gprs_connection->token);
+			"\n\tgprs_connection->state=%d\n\tgprs_connection->token=0x%x",
+				gprs_connection->state, (unsigned)gprs_connection->token);
 
-			ril_unsol_data_call_list_changed();
+			ril_data_call_list_reconcile();
 		}
 	}
 }
@@ -780,112 +1597,288 @@ fail_cause_return:
 	RIL_onRequestComplete(t, RIL_E_SUCCESS, &fail_cause, sizeof(fail_cause));
 }
 
+/**
+ * Data call list:
+ * The list is maintained from our own connections table, that follows
+ * IP_CONFIGURATION and CALL_STATUS, and rendered again into static buffers
+ * only when it changed. The modem list is only asked for to reconcile with
+ * it, either periodically or when it reported something unexpected.
+ *
+ * Changes and reconciliations are coalesced within a short window, so that
+ * a flapping context leads to a single query and a single unsolicited
+ * response, which is not even sent when the list is the same as last time.
+ */
+
+void ril_data_call_list_invalidate(void)
+{
+	ril_data_call_list_dirty = 1;
+}
+
+void ril_data_call_list_render(void)
+{
+	struct ril_gprs_connection *gprs_connection;
+	struct ril_gprs_data_call_strings *strings;
+	struct ipc_gprs_ip_configuration *ip_configuration;
+	RIL_Data_Call_Response *response;
+	int i;
+
+	if(!ril_data_call_list_dirty)
+		return;
+
+	memset(ril_data_call_list, 0, sizeof(ril_data_call_list));
+	memset(ril_data_call_list_strings, 0, sizeof(ril_data_call_list_strings));
+	ril_data_call_list_count = 0;
+
+	for(i=0 ; i < ril_gprs_connections_count ; i++) {
+		gprs_connection = &ril_gprs_connections[i];
+
+		if(gprs_connection->state != RIL_GPRS_CONNECTION_ENABLED &&
+			gprs_connection->state != RIL_GPRS_CONNECTION_TEARDOWN)
+			continue;
+
+		response = &ril_data_call_list[ril_data_call_list_count];
+		strings = &ril_data_call_list_strings[ril_data_call_list_count];
+		ip_configuration = &(gprs_connection->ip_configuration);
+
+		snprintf(strings->type, sizeof(strings->type), "IP");
+		snprintf(strings->address, sizeof(strings->address), "%i.%i.%i.%i",
+			(ip_configuration->ip)[0],
+			(ip_configuration->ip)[1],
+			(ip_configuration->ip)[2],
+			(ip_configuration->ip)[3]);
+
+		response->cid = gprs_connection->cid;
+		response->active = 2;
+		response->type = strings->type;
+
+#if RIL_VERSION >= 6
+		snprintf(strings->ifname, sizeof(strings->ifname), "%s",
+			gprs_connection->interface);
+		snprintf(strings->dnses, sizeof(strings->dnses), "%i.%i.%i.%i %i.%i.%i.%i",
+			ip_configuration->dns1[0],
+			ip_configuration->dns1[1],
+			ip_configuration->dns1[2],
+			ip_configuration->dns1[3],
+
+			ip_configuration->dns2[0],
+			ip_configuration->dns2[1],
+			ip_configuration->dns2[2],
+			ip_configuration->dns2[3]);
+
+		response->status = 0;
+		response->ifname = strings->ifname;
+		response->addresses = strings->address;
+		response->gateways = strings->address;
+		response->dnses = strings->dnses;
+#else
+		snprintf(strings->apn, sizeof(strings->apn), "%s",
+			gprs_connection->define_context.apn);
+
+		response->apn = strings->apn;
+		response->address = strings->address;
+#endif
+
+		ril_data_call_list_count++;
+	}
+
+	ril_data_call_list_dirty = 0;
+}
+
+int ril_data_call_list_sent_same(void)
+{
+	int i;
+
+	if(!ril_data_call_list_sent_valid ||
+		ril_data_call_list_sent_count != ril_data_call_list_count)
+		return 0;
+
+	for(i=0 ; i < ril_data_call_list_count ; i++) {
+		if(ril_data_call_list_sent_cids[i] != ril_data_call_list[i].cid)
+			return 0;
+	}
+
+	return memcmp(ril_data_call_list_sent_strings, ril_data_call_list_strings,
+		ril_data_call_list_count * sizeof(struct ril_gprs_data_call_strings)) == 0;
+}
+
+void ril_data_call_list_sent_save(void)
+{
+	int i;
+
+	for(i=0 ; i < ril_data_call_list_count ; i++)
+		ril_data_call_list_sent_cids[i] = ril_data_call_list[i].cid;
+
+	memcpy(ril_data_call_list_sent_strings, ril_data_call_list_strings,
+		ril_data_call_list_count * sizeof(struct ril_gprs_data_call_strings));
+
+	ril_data_call_list_sent_count = ril_data_call_list_count;
+	ril_data_call_list_sent_valid = 1;
+}
+
+void ril_data_call_list_window(void *data)
+{
+	ril_data_call_list_scheduled = 0;
+
+	if(ril_data_call_list_reconcile_needed) {
+		ril_data_call_list_reconcile_needed = 0;
+		ril_data_call_list_timestamp = ril_timestamp_ms();
+
+		ipc_fmt_send_get(IPC_GPRS_PDP_CONTEXT, 0xff);
+	}
+
+	if(!ril_data_call_list_changed)
+		return;
+
+	ril_data_call_list_changed = 0;
+
+	// Don't wake the AP up while the screen is off
+	if(ril_screen_state_off()) {
+		ril_data_call_list_pending = 1;
+		return;
+	}
+
+	ril_data_call_list_render();
+
+	if(ril_data_call_list_sent_same()) {
+		LOGD("Data call list didn't change, not reporting it");
+		return;
+	}
+
+	ril_data_call_list_sent_save();
+
+	RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED,
+		ril_data_call_list, ril_data_call_list_count * sizeof(RIL_Data_Call_Response));
+}
+
+void ril_data_call_list_schedule(void)
+{
+	if(ril_data_call_list_scheduled)
+		return;
+
+	if(ril_timed_callback(ril_data_call_list_window, NULL,
+		RIL_DATA_CALL_LIST_CHANGED_WINDOW) < 0) {
+		ril_data_call_list_window(NULL);
+		return;
+	}
+
+	ril_data_call_list_scheduled = 1;
+}
+
+void ril_data_call_list_reconcile(void)
+{
+	ril_data_call_list_reconcile_needed = 1;
+
+	ril_data_call_list_schedule();
+}
+
 /*
  * Some modem firmwares have a bug that will make the first cid (1) overriden
  * by the current cid, thus reporting it twice, with a wrong 2nd status.
  *
  * This shouldn't change anything to healthy structures.
  */
-void ipc_gprs_pdp_context_fix(RIL_Data_Call_Response *data_call_list, int c)
+void ipc_gprs_pdp_context_fix(int *cids, int c)
 {
-	int i, j, k;
+	int i, j;
 
 	for(i=0 ; i < c ; i++) {
 		for(j=i-1 ; j >= 0 ; j--) {
-			if(data_call_list[i].cid == data_call_list[j].cid) {
-				for(k=0 ; k < c ; k++) {
-					if(data_call_list[k].cid == 1) {
-						data_call_list[i].cid = 0;
-						break;
-					}
-				}
-
-				data_call_list[i].cid = 1;
-			}
+			if(cids[i] == cids[j])
+				cids[i] = 1;
 		}
 	}
 }
 
+/**
+ * In: IPC_GPRS_PDP_CONTEXT
+ *   Compare the modem PDP contexts with our connections
+ *
+ * Out: RIL_UNSOL_DATA_CALL_LIST_CHANGED
+ *   Report the data call list again if connections were dropped
+ */
 void ipc_gprs_pdp_context(struct ipc_message_info *info)
 {
 	struct ril_gprs_connection *gprs_connection;
-        struct ipc_gprs_ip_configuration *ip_configuration;
 	struct ipc_gprs_pdp_context_get *context =
 		(struct ipc_gprs_pdp_context_get *) info->data;
 
-	RIL_Data_Call_Response data_call_list[IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT];
-	memset(data_call_list, 0, sizeof(data_call_list));
+	int cids[IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT];
+	int mismatch = 0;
+	int enabled;
+	int i, j;
 
-	int i;
+	if(info->data == NULL || info->length < sizeof(struct ipc_gprs_pdp_context_get))
+		return;
+
+	for(i=0 ; i < IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT ; i++)
+		cids[i] = context->desc[i].cid;
+
+	ipc_gprs_pdp_context_fix(cids, IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT);
 
 	for(i=0 ; i < IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT ; i++) {
-		data_call_list[i].cid = context->desc[i].cid;
-		data_call_list[i].active =
-			ipc2ril_gprs_connection_active(context->desc[i].state);
+		if(context->desc[i].state != IPC_GPRS_STATE_ENABLED)
+			continue;
 
-		if(context->desc[i].state == IPC_GPRS_STATE_ENABLED) {
-			gprs_connection = ril_gprs_connection_get_cid(context->desc[i].cid);
+		if(ril_gprs_connection_get_cid(cids[i]) == NULL)
+			LOGE("CID %d reported as enabled but not listed here", cids[i]);
+	}
 
-			if(gprs_connection == NULL) {
-				LOGE("CID %d reported as enabled but not listed here",
-					context->desc[i].cid);
-				continue;
-			}
+	for(i=0 ; i < ril_gprs_connections_count ; i++) {
+		gprs_connection = &ril_gprs_connections[i];
 
-			ip_configuration = &(gprs_connection->ip_configuration);
-
-			char *addr = NULL;
-			asprintf(&addr, "%i.%i.%i.%i",
-				(ip_configuration->ip)[0],
-				(ip_configuration->ip)[1],
-				(ip_configuration->ip)[2],
-				(ip_configuration->ip)[3]);
-
-			RIL_Data_Call_Response *resp = &data_call_list[i];
-			resp->type = strdup("IP");
-
-			#if RIL_VERSION < 6
-			resp->address = addr;
-			asprintf(&(resp->apn), "%s",
-				gprs_connection->define_context.apn);
-			#else
-			resp->addresses = addr;
-			resp->gateways = strdup(addr);
-			resp->ifname = strdup(gprs_connection->interface);
-			asprintf(&resp->dnses, "%i.%i.%i.%i %i.%i.%i.%i",
-				ip_configuration->dns1[0],
-				ip_configuration->dns1[1],
-				ip_configuration->dns1[2],
-				ip_configuration->dns1[3],
-
-				ip_configuration->dns2[0],
-				ip_configuration->dns2[1],
-				ip_configuration->dns2[2],
-				ip_configuration->dns2[3]);
-			#endif
+		if(gprs_connection->state != RIL_GPRS_CONNECTION_ENABLED)
+			continue;
+
+		enabled = 0;
+		for(j=0 ; j < IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT ; j++) {
+			if(cids[j] == gprs_connection->cid &&
+				context->desc[j].state == IPC_GPRS_STATE_ENABLED)
+				enabled = 1;
 		}
-	}
 
-	ipc_gprs_pdp_context_fix(data_call_list, IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT);
+		if(enabled)
+			continue;
 
-	if(info->aseq == 0xff)
-		RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED,
-			&data_call_list, sizeof(data_call_list));
-	else
-		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS,
-			&data_call_list, sizeof(data_call_list));
+		LOGE("CID %d is not enabled anymore, dropping it", gprs_connection->cid);
+
+		if(ril_gprs_job_queue(gprs_connection, RIL_GPRS_JOB_DISABLE) < 0)
+			LOGE("Failed to queue GPRS interface teardown");
 
-	for(i = 0; i < IPC_GPRS_PDP_CONTEXT_GET_DESC_COUNT; i++) {
-		cleanup_ril_data_call_response(data_call_list + i);
+		ril_gprs_connection_del(gprs_connection);
+		mismatch = 1;
 	}
+
+	if(mismatch)
+		ril_unsol_data_call_list_changed();
 }
 
 void ril_unsol_data_call_list_changed(void)
 {
-	ipc_fmt_send_get(IPC_GPRS_PDP_CONTEXT, 0xff);
+	ril_data_call_list_changed = 1;
+
+	ril_data_call_list_schedule();
+}
+
+void ril_data_call_list_flush(void)
+{
+	if(!ril_data_call_list_pending)
+		return;
+
+	ril_data_call_list_pending = 0;
+
+	ril_unsol_data_call_list_changed();
 }
 
 void ril_request_data_call_list(RIL_Token t)
 {
-	ipc_fmt_send_get(IPC_GPRS_PDP_CONTEXT, reqGetId(t));
+	ril_data_call_list_render();
+
+	// RILJ knows about this list now
+	ril_data_call_list_sent_save();
+
+	RIL_onRequestComplete(t, RIL_E_SUCCESS,
+		ril_data_call_list, ril_data_call_list_count * sizeof(RIL_Data_Call_Response));
+
+	if(ril_timestamp_ms() - ril_data_call_list_timestamp >= RIL_DATA_CALL_LIST_RECONCILE_INTERVAL)
+		ril_data_call_list_reconcile();
 }
@@ -32,12 +32,17 @@
 
 #define SRS_CONTROL			0x01
 #define SRS_CONTROL_PING		0x0101
+#define SRS_CONTROL_DATA_CALL_STATS	0x0102
+#define SRS_CONTROL_DATA_CALL_TRAFFIC	0x0103
 
 #define SRS_SND				0x02
 #define SRS_SND_SET_CALL_VOLUME		0x0201
 #define SRS_SND_SET_CALL_AUDIO_PATH	0x0202
 #define SRS_SND_SET_CALL_CLOCK_SYNC	0x0203
 
+#define SRS_NET				0x03
+#define SRS_NET_PLMN_LIST_REFRESH	0x0301
+
 #define SRS_CONTROL_CAFFE		0xCAFFE
 
 enum srs_snd_type {
@@ -61,6 +66,60 @@ enum srs_snd_clock {
 	SND_CLOCK_START
 };
 
+/*
+ * Data call setup stages, in the order they happen:
+ * each stage lasts from the end of the previous one that happened
+ */
+enum srs_data_call_stage {
+	SRS_DATA_CALL_STAGE_PORT_LIST,
+	SRS_DATA_CALL_STAGE_DEFINE,
+	SRS_DATA_CALL_STAGE_ACTIVATE,
+	SRS_DATA_CALL_STAGE_IP_CONFIGURATION,
+	SRS_DATA_CALL_STAGE_CALL_STATUS,
+	SRS_DATA_CALL_STAGE_INTERFACE,
+	SRS_DATA_CALL_STAGE_PROPERTIES,
+	SRS_DATA_CALL_STAGE_TOTAL,
+	SRS_DATA_CALL_STAGE_COUNT
+};
+
+/*
+ * Buckets upper bounds in ms: 10, 20, 50, 100, 200, 500, 1000, 2000, 5000,
+ * 10000 and the last bucket holds anything longer
+ */
+#define SRS_DATA_CALL_HISTOGRAM_BUCKETS	11
+#define SRS_DATA_CALL_APN_LEN		124
+
+struct srs_data_call_histogram {
+	unsigned int buckets[SRS_DATA_CALL_HISTOGRAM_BUCKETS];
+	unsigned int count;
+	unsigned int total_ms;
+	unsigned int max_ms;
+} __attribute__((__packed__));
+
+/*
+ * SRS_CONTROL_DATA_CALL_STATS takes an optional APN string:
+ * stats for all the APNs are returned when it is empty
+ */
+struct srs_data_call_stats {
+	char apn[SRS_DATA_CALL_APN_LEN];
+	struct srs_data_call_histogram stages[SRS_DATA_CALL_STAGE_COUNT];
+} __attribute__((__packed__));
+
+/*
+ * SRS_CONTROL_DATA_CALL_TRAFFIC returns one entry per active data call,
+ * with the counters read at the last sample
+ */
+struct srs_data_call_traffic {
+	int cid;
+	char ifname[16];
+	unsigned long long rx_bytes;
+	unsigned long long tx_bytes;
+	unsigned long long rx_packets;
+	unsigned long long tx_packets;
+	unsigned int rx_idle_ms;
+	unsigned int stalled;
+} __attribute__((__packed__));
+
 struct srs_snd_call_volume {
 	enum srs_snd_type type;
 	int volume;
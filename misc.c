@@ -22,9 +22,17 @@
 #define LOG_TAG "RIL-MISC"
 #include <utils/Log.h>
 
+#include <time.h>
+
 #include "samsung-ril.h"
 #include "util.h"
 
+/**
+ * MISC global vars
+ */
+
+struct ril_nitz ril_nitz;
+
 void ril_request_get_imei_send(RIL_Token t)
 {
 	unsigned char data;
@@ -227,9 +235,8 @@ void ipc_misc_me_imsi(struct ipc_message_info *info)
 		RIL_E_SUCCESS, imsi, *imsi_length+1);
 }
 
-void ipc_misc_time_info(struct ipc_message_info *info)
+void ril_nitz_send(struct ipc_misc_time_info *nitz)
 {
-	struct ipc_misc_time_info *nitz = (struct ipc_misc_time_info*) info->data;
 	char str[128];
 
 	sprintf(str, "%02u/%02u/%02u,%02u:%02u:%02u+%02d,%02d",
@@ -239,3 +246,64 @@ void ipc_misc_time_info(struct ipc_message_info *info)
 	RIL_onUnsolicitedResponse(RIL_UNSOL_NITZ_TIME_RECEIVED,
 		str, strlen(str) + 1);
 }
+
+/**
+ * In: IPC_MISC_TIME_INFO
+ *   Network time
+ *
+ * Out: RIL_UNSOL_NITZ_TIME_RECEIVED
+ *   Send it right away, or keep it for later when the screen is off
+ */
+void ipc_misc_time_info(struct ipc_message_info *info)
+{
+	struct ipc_misc_time_info *nitz = (struct ipc_misc_time_info*) info->data;
+
+	if(info->data == NULL || info->length < sizeof(struct ipc_misc_time_info))
+		return;
+
+	if(ril_screen_state_off()) {
+		memcpy(&ril_nitz.time_info, nitz, sizeof(struct ipc_misc_time_info));
+		// The screen is off while suspended, which the monotonic clock ignores
+		ril_nitz.timestamp = ril_boottime_ms();
+		ril_nitz.pending = 1;
+		return;
+	}
+
+	ril_nitz_send(nitz);
+}
+
+/**
+ * Sends the NITZ received while the screen was off, with its time
+ * moved forward by the delay it was held back for
+ */
+void ril_nitz_flush(void)
+{
+	struct ipc_misc_time_info *nitz = &ril_nitz.time_info;
+	struct tm tm;
+	time_t t;
+
+	if(!ril_nitz.pending)
+		return;
+
+	ril_nitz.pending = 0;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = nitz->year + 100;
+	tm.tm_mon = nitz->mon - 1;
+	tm.tm_mday = nitz->day;
+	tm.tm_hour = nitz->hour;
+	tm.tm_min = nitz->min;
+	tm.tm_sec = nitz->sec;
+
+	t = timegm(&tm) + (ril_boottime_ms() - ril_nitz.timestamp) / 1000;
+	gmtime_r(&t, &tm);
+
+	nitz->year = tm.tm_year % 100;
+	nitz->mon = tm.tm_mon + 1;
+	nitz->day = tm.tm_mday;
+	nitz->hour = tm.tm_hour;
+	nitz->min = tm.tm_min;
+	nitz->sec = tm.tm_sec;
+
+	ril_nitz_send(nitz);
+}
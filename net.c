@@ -27,6 +27,12 @@
 
 #include <plmn_list.h>
 
+/**
+ * NET global vars
+ */
+
+struct ril_net_plmn_list ril_net_plmn_list;
+
 /**
  * Format conversion utils
  */
@@ -698,21 +704,120 @@ void ipc_net_regist(struct ipc_message_info *message)
 
 }
 
+/**
+ * Available PLMN list cache:
+ * A PLMN list request triggers a full radio scan that can take tens of seconds.
+ * The decoded list is kept for RIL_NET_PLMN_LIST_TTL ms and served from there,
+ * while requests arriving during a scan are attached to it instead of starting
+ * another one. The cache is dropped on radio power changes, after a network
+ * selection and on explicit SRS_NET_PLMN_LIST_REFRESH.
+ */
+
+void ril_net_plmn_list_entries_free(void)
+{
+	int i;
+
+	if(ril_net_plmn_list.entries == NULL)
+		return;
+
+	for(i=0 ; i < ril_net_plmn_list.entries_count * 4 ; i++) {
+		if(ril_net_plmn_list.entries[i] != NULL)
+			free(ril_net_plmn_list.entries[i]);
+	}
+
+	free(ril_net_plmn_list.entries);
+
+	ril_net_plmn_list.entries = NULL;
+	ril_net_plmn_list.entries_count = 0;
+	ril_net_plmn_list.timestamp = 0;
+}
+
+void ril_net_plmn_list_init(void)
+{
+	int i;
+
+	// The modem is not going to answer anymore
+	for(i=0 ; i < ril_net_plmn_list.tokens_count ; i++)
+		RIL_onRequestComplete(ril_net_plmn_list.tokens[i],
+			RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+
+	ril_net_plmn_list_entries_free();
+
+	memset(&ril_net_plmn_list, 0, sizeof(struct ril_net_plmn_list));
+}
+
+void ril_net_plmn_list_invalidate(void)
+{
+	LOGD("Dropping cached PLMN list");
+
+	ril_net_plmn_list_entries_free();
+}
+
+void ril_net_plmn_list_complete(RIL_Errno e)
+{
+	int i;
+
+	for(i=0 ; i < ril_net_plmn_list.tokens_count ; i++) {
+		if(e == RIL_E_SUCCESS)
+			RIL_onRequestComplete(ril_net_plmn_list.tokens[i], RIL_E_SUCCESS,
+				ril_net_plmn_list.entries,
+				4 * sizeof(char *) * ril_net_plmn_list.entries_count);
+		else
+			RIL_onRequestComplete(ril_net_plmn_list.tokens[i], e, NULL, 0);
+	}
+
+	ril_net_plmn_list.tokens_count = 0;
+}
+
 /**
  * In: RIL_REQUEST_QUERY_AVAILABLE_NETWORKS
+ *   return the cached PLMN list if it is still fresh
+ *   attach to the scan in progress if there is one
  *
  * Out: IPC_NET_PLMN_LIST
+ *   request a new scan otherwise
  */
 void ril_request_query_available_networks(RIL_Token t)
 {
+	long long now = ril_timestamp_ms();
+
+	if(ril_net_plmn_list.timestamp != 0 &&
+		now - ril_net_plmn_list.timestamp < RIL_NET_PLMN_LIST_TTL) {
+		LOGD("Returning cached PLMN list (%lld ms old)",
+			now - ril_net_plmn_list.timestamp);
+
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, ril_net_plmn_list.entries,
+			4 * sizeof(char *) * ril_net_plmn_list.entries_count);
+		return;
+	}
+
+	if(ril_net_plmn_list.tokens_count >= RIL_NET_PLMN_LIST_TOKENS_MAX) {
+		LOGE("Too many PLMN list requests waiting, aborting");
+
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	ril_net_plmn_list.tokens[ril_net_plmn_list.tokens_count] = t;
+	ril_net_plmn_list.tokens_count++;
+
+	if(ril_net_plmn_list.scan_timestamp != 0 &&
+		now - ril_net_plmn_list.scan_timestamp < RIL_NET_PLMN_LIST_TIMEOUT) {
+		LOGD("PLMN scan already in progress, waiting for it");
+		return;
+	}
+
+	ril_net_plmn_list.scan_timestamp = now;
+
 	ipc_fmt_send_get(IPC_NET_PLMN_LIST, reqGetId(t));
 }
 
-/* FIXME: cleanup struct names & resp[] addressing */
 /**
  * In: IPC_NET_PLMN_LIST
- * Send back available PLMN list
+ *   Decode and cache the available PLMN list
  *
+ * Out: RIL_REQUEST_QUERY_AVAILABLE_NETWORKS
+ *   Send back the list to every request waiting for the scan
  */
 void ipc_net_plmn_list(struct ipc_message_info *info)
 {
@@ -720,15 +825,26 @@ void ipc_net_plmn_list(struct ipc_message_info *info)
 	struct ipc_net_plmn_entry *entries = (struct ipc_net_plmn_entry *)
 		(info->data + sizeof(struct ipc_net_plmn_entries));
 
+	char **resp;
+	char **resp_ptr;
+	int count = 0;
 	int i;
-	int size = (4 * entries_info->num * sizeof(char*));
-	int actual_size = 0;
 
-	char **resp = malloc(size);
-	char **resp_ptr = resp;
+	if(info->length < sizeof(struct ipc_net_plmn_entries) ||
+		info->length < sizeof(struct ipc_net_plmn_entries) +
+		entries_info->num * sizeof(struct ipc_net_plmn_entry)) {
+		LOGE("%s: invalid PLMN list length: %d", __FUNCTION__, info->length);
+
+		ril_net_plmn_list.scan_timestamp = 0;
+		ril_net_plmn_list_complete(RIL_E_GENERIC_FAILURE);
+		return;
+	}
 
 	LOGD("Listed %d PLMNs\n", entries_info->num);
 
+	resp = calloc(4 * entries_info->num + 1, sizeof(char *));
+	resp_ptr = resp;
+
 	for(i = 0; i < entries_info->num; i++) {
 		/* Assumed type for 'emergency only' PLMNs */
 		if(entries[i].type == 0x01)
@@ -752,21 +868,82 @@ void ipc_net_plmn_list(struct ipc_message_info *info)
 				break;
 		}
 
-		actual_size++;
+		count++;
 		resp_ptr += 4;
 	}
 
-	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, resp, (4 * sizeof(char*) * actual_size));
+	ril_net_plmn_list_entries_free();
+
+	ril_net_plmn_list.entries = resp;
+	ril_net_plmn_list.entries_count = count;
+	ril_net_plmn_list.timestamp = ril_timestamp_ms();
+	ril_net_plmn_list.scan_timestamp = 0;
+
+	ril_net_plmn_list_complete(RIL_E_SUCCESS);
+}
+
+/**
+ * In: SRS_NET_PLMN_LIST_REFRESH
+ *   Drop the cached PLMN list so that the next request triggers a new scan
+ */
+void srs_net_plmn_list_refresh(struct srs_message *message)
+{
+	ril_net_plmn_list_invalidate();
+}
+
+/**
+ * Network settings cache:
+ * The preferred network type and the PLMN selection mode only change when
+ * we set them (or when the modem notifies us), so they are kept in ril_state
+ * and GET requests are answered locally. The cached values are dropped when
+ * the radio is power cycled, so that the modem is asked again afterwards.
+ */
 
-	/* FIXME: free individual strings */
-	free(resp);
+void ril_net_sel_invalidate(void)
+{
+	ril_state.mode_sel_valid = 0;
+	ril_state.plmn_sel_valid = 0;
 }
 
+/**
+ * In: RIL_REQUEST_GET_PREFERRED_NETWORK_TYPE
+ *   Return the cached preferred network type if known
+ *
+ * Out: IPC_NET_MODE_SEL
+ *   Ask the modem otherwise
+ */
 void ril_request_get_preferred_network_type(RIL_Token t)
 {
+	if(ril_state.mode_sel_valid) {
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, &ril_state.mode_sel, sizeof(int));
+		return;
+	}
+
 	ipc_fmt_send_get(IPC_NET_MODE_SEL, reqGetId(t));
 }
 
+void ipc_net_mode_sel_complete(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
+	int rc;
+
+	rc = ipc_gen_phone_res_check(phone_res);
+	if(rc < 0) {
+		LOGE("There was an error during preferred network type selection!");
+
+		// We can't be sure of what the modem is using now
+		ril_state.mode_sel_valid = 0;
+
+		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	ril_state.mode_sel = ril_state.mode_sel_pending;
+	ril_state.mode_sel_valid = 1;
+
+	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, NULL, 0);
+}
+
 void ril_request_set_preferred_network_type(RIL_Token t, void *data, size_t datalen)
 {
 	int ril_mode = *(int*)data;
@@ -774,25 +951,68 @@ void ril_request_set_preferred_network_type(RIL_Token t, void *data, size_t data
 
 	mode_sel.mode_sel = ril2ipc_mode_sel(ril_mode);
 
-	ipc_gen_phone_res_expect_to_complete(reqGetId(t), IPC_NET_MODE_SEL);
+	// Store what the modem will report back for this setting
+	ril_state.mode_sel_pending = ipc2ril_mode_sel(mode_sel.mode_sel);
+
+	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_NET_MODE_SEL, ipc_net_mode_sel_complete);
 
 	ipc_fmt_send(IPC_NET_MODE_SEL, IPC_TYPE_SET, &mode_sel, sizeof(mode_sel), reqGetId(t));
 }
 
+/**
+ * In: IPC_NET_MODE_SEL
+ *   Update the cached preferred network type
+ *
+ * Out: RIL_REQUEST_GET_PREFERRED_NETWORK_TYPE
+ *   Send back the preferred network type when it was requested
+ */
 void ipc_net_mode_sel(struct ipc_message_info *info)
 {
-	struct ipc_net_mode_sel *mode_sel = (struct ipc_net_mode_sel *) info->data;
-	int ril_mode = ipc2ril_mode_sel(mode_sel->mode_sel);
+	struct ipc_net_mode_sel *mode_sel;
+	int ril_mode;
+
+	if(info->data == NULL || info->length < sizeof(struct ipc_net_mode_sel)) {
+		if(info->type != IPC_TYPE_NOTI)
+			RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	mode_sel = (struct ipc_net_mode_sel *) info->data;
+	ril_mode = ipc2ril_mode_sel(mode_sel->mode_sel);
+
+	ril_state.mode_sel = ril_mode;
+	ril_state.mode_sel_valid = 1;
+
+	if(info->type == IPC_TYPE_NOTI)
+		return;
 
 	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, &ril_mode, sizeof(int));
 }
 
-
+/**
+ * In: RIL_REQUEST_QUERY_NETWORK_SELECTION_MODE
+ *   Return the cached PLMN selection mode if known
+ *
+ * Out: IPC_NET_PLMN_SEL
+ *   Ask the modem otherwise
+ */
 void ril_request_query_network_selection_mode(RIL_Token t)
 {
+	if(ril_state.plmn_sel_valid) {
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, &ril_state.plmn_sel, sizeof(int));
+		return;
+	}
+
 	ipc_fmt_send_get(IPC_NET_PLMN_SEL, reqGetId(t));
 }
 
+/**
+ * In: IPC_NET_PLMN_SEL
+ *   Update the cached PLMN selection mode
+ *
+ * Out: RIL_REQUEST_QUERY_NETWORK_SELECTION_MODE
+ *   Send back the PLMN selection mode when it was requested
+ */
 void ipc_net_plmn_sel(struct ipc_message_info *info)
 {
 	struct ipc_net_plmn_sel_get *plmn_sel;
@@ -801,11 +1021,21 @@ void ipc_net_plmn_sel(struct ipc_message_info *info)
 	if (!info)
 		return;
 	
-	if (!info->data || info->length < sizeof(struct ipc_net_plmn_sel_get))
+	if (!info->data || info->length < sizeof(struct ipc_net_plmn_sel_get)) {
+		if(info->type != IPC_TYPE_NOTI)
+			RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
 		return;
+	}
 	
 	plmn_sel = (struct ipc_net_plmn_sel_get *) info->data;
 	ril_mode = ipc2ril_plmn_sel(plmn_sel->plmn_sel);
+
+	ril_state.plmn_sel = ril_mode;
+	ril_state.plmn_sel_valid = 1;
+
+	if(info->type == IPC_TYPE_NOTI)
+		return;
+
 	RIL_onRequestComplete(reqGetToken(info->aseq),
 		RIL_E_SUCCESS, &ril_mode, sizeof(int));
 }
@@ -824,9 +1054,18 @@ void ipc_net_plmn_sel_complete(struct ipc_message_info *info)
 			LOGE("There was an error during operator selection!");
 			RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
 		}
+
+		// We can't be sure of what the modem is using now
+		ril_state.plmn_sel_valid = 0;
 		return;
 	}
 
+	ril_state.plmn_sel = ril_state.plmn_sel_pending;
+	ril_state.plmn_sel_valid = 1;
+
+	// The current PLMN of the cached list is likely to have changed
+	ril_net_plmn_list_invalidate();
+
 	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, NULL, 0);
 }
 
@@ -836,6 +1075,8 @@ void ril_request_set_network_selection_automatic(RIL_Token t)
 
 	ipc_net_plmn_sel_setup(&plmn_sel, IPC_NET_PLMN_SEL_AUTO, NULL, IPC_NET_ACCESS_TECHNOLOGY_UNKNOWN);
 
+	ril_state.plmn_sel_pending = ipc2ril_plmn_sel(IPC_NET_PLMN_SEL_AUTO);
+
 	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_NET_PLMN_SEL, ipc_net_plmn_sel_complete);
 
 	ipc_fmt_send(IPC_NET_PLMN_SEL, IPC_TYPE_SET, &plmn_sel, sizeof(plmn_sel), reqGetId(t));
@@ -848,6 +1089,8 @@ void ril_request_set_network_selection_manual(RIL_Token t, void *data, size_t da
 	// FIXME: We always assume UMTS capability
 	ipc_net_plmn_sel_setup(&plmn_sel, IPC_NET_PLMN_SEL_MANUAL, data, IPC_NET_ACCESS_TECHNOLOGY_UMTS);
 
+	ril_state.plmn_sel_pending = ipc2ril_plmn_sel(IPC_NET_PLMN_SEL_MANUAL);
+
 	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_NET_PLMN_SEL, ipc_net_plmn_sel_complete);
 
 	ipc_fmt_send(IPC_NET_PLMN_SEL, IPC_TYPE_SET, &plmn_sel, sizeof(plmn_sel), reqGetId(t));
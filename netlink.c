@@ -0,0 +1,611 @@
+/**
+ * This file is part of samsung-ril.
+ *
+ * samsung-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * samsung-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with samsung-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "netlink.h"
+
+#define RIL_NETLINK_BUFFER_SIZE		4096
+#define RIL_NETLINK_ADDRESSES_MAX	8
+#define RIL_NETLINK_TIMEOUT		2
+
+/**
+ * A batch holds several rtnetlink requests, sent at once with a single
+ * syscall. Every request asks for an ACK, that are all read back afterwards.
+ */
+struct ril_netlink_batch {
+	char buffer[RIL_NETLINK_BUFFER_SIZE];
+	size_t length;
+	unsigned int seq;
+	int count;
+};
+
+struct ril_netlink_address {
+	in_addr_t address;
+	unsigned char prefix_length;
+};
+
+static unsigned int ril_netlink_seq;
+
+/**
+ * Netlink socket and batch utils
+ */
+
+static int ril_netlink_open(void)
+{
+	struct timeval timeout;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if(fd < 0)
+		return -errno;
+
+	// Never let a missing answer hang the caller
+	timeout.tv_sec = RIL_NETLINK_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	return fd;
+}
+
+static void ril_netlink_batch_init(struct ril_netlink_batch *batch)
+{
+	memset(batch, 0, sizeof(struct ril_netlink_batch));
+
+	batch->seq = ++ril_netlink_seq;
+}
+
+static struct nlmsghdr *ril_netlink_batch_add(struct ril_netlink_batch *batch,
+	int type, int flags, void *payload, size_t payload_length)
+{
+	struct nlmsghdr *nlh;
+
+	if(batch->length + NLMSG_SPACE(payload_length) > sizeof(batch->buffer))
+		return NULL;
+
+	nlh = (struct nlmsghdr *) (batch->buffer + batch->length);
+	memset(nlh, 0, NLMSG_SPACE(payload_length));
+
+	nlh->nlmsg_len = NLMSG_LENGTH(payload_length);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_seq = batch->seq + batch->count;
+
+	memcpy(NLMSG_DATA(nlh), payload, payload_length);
+
+	batch->length += NLMSG_ALIGN(nlh->nlmsg_len);
+	batch->count++;
+
+	return nlh;
+}
+
+static int ril_netlink_attr_add(struct ril_netlink_batch *batch,
+	struct nlmsghdr *nlh, int type, void *data, size_t length)
+{
+	struct rtattr *rta;
+	size_t offset = (char *) nlh - batch->buffer;
+
+	if(offset + NLMSG_ALIGN(nlh->nlmsg_len) + RTA_SPACE(length) > sizeof(batch->buffer))
+		return -ENOBUFS;
+
+	rta = (struct rtattr *) ((char *) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(length);
+	memcpy(RTA_DATA(rta), data, length);
+
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	batch->length = offset + NLMSG_ALIGN(nlh->nlmsg_len);
+
+	return 0;
+}
+
+/**
+ * Sends the whole batch and waits for all the ACKs
+ * Returns the first error reported by the kernel, if any
+ */
+static int ril_netlink_batch_send(int fd, struct ril_netlink_batch *batch)
+{
+	struct sockaddr_nl addr;
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	char buffer[RIL_NETLINK_BUFFER_SIZE];
+	int acks = 0;
+	int error = 0;
+	int rc;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	rc = sendto(fd, batch->buffer, batch->length, 0,
+		(struct sockaddr *) &addr, sizeof(addr));
+	if(rc < 0)
+		return -errno;
+
+	while(acks < batch->count) {
+		rc = recv(fd, buffer, sizeof(buffer), 0);
+		if(rc < 0) {
+			if(errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for(nlh = (struct nlmsghdr *) buffer ; NLMSG_OK(nlh, (unsigned int) rc) ;
+			nlh = NLMSG_NEXT(nlh, rc)) {
+			if(nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			if(nlh->nlmsg_seq < batch->seq ||
+				nlh->nlmsg_seq >= batch->seq + batch->count)
+				continue;
+
+			err = (struct nlmsgerr *) NLMSG_DATA(nlh);
+			if(err->error < 0 && error == 0)
+				error = err->error;
+
+			acks++;
+		}
+	}
+
+	return error;
+}
+
+/**
+ * Dumps the IPv4 addresses of the interface
+ * Returns the number of addresses found
+ */
+static int ril_netlink_addresses_dump(int fd, int ifindex,
+	struct ril_netlink_address *addresses, int addresses_max)
+{
+	struct sockaddr_nl addr;
+	struct nlmsghdr *nlh;
+	struct ifaddrmsg *ifa;
+	struct rtattr *rta;
+	struct ril_netlink_batch batch;
+	struct ifaddrmsg ifa_request;
+	char buffer[RIL_NETLINK_BUFFER_SIZE];
+	in_addr_t address;
+	int addresses_count = 0;
+	int length;
+	int done = 0;
+	int rc;
+
+	memset(&ifa_request, 0, sizeof(ifa_request));
+	ifa_request.ifa_family = AF_INET;
+
+	ril_netlink_batch_init(&batch);
+	nlh = ril_netlink_batch_add(&batch, RTM_GETADDR, NLM_F_DUMP,
+		&ifa_request, sizeof(ifa_request));
+	if(nlh == NULL)
+		return -ENOBUFS;
+
+	// A dump is answered with NLMSG_DONE, not with an ACK
+	nlh->nlmsg_flags &= ~NLM_F_ACK;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	rc = sendto(fd, batch.buffer, batch.length, 0,
+		(struct sockaddr *) &addr, sizeof(addr));
+	if(rc < 0)
+		return -errno;
+
+	while(!done) {
+		rc = recv(fd, buffer, sizeof(buffer), 0);
+		if(rc < 0) {
+			if(errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for(nlh = (struct nlmsghdr *) buffer ; NLMSG_OK(nlh, (unsigned int) rc) ;
+			nlh = NLMSG_NEXT(nlh, rc)) {
+			if(nlh->nlmsg_seq != batch.seq)
+				continue;
+
+			if(nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+
+			if(nlh->nlmsg_type == NLMSG_ERROR)
+				return ((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+
+			if(nlh->nlmsg_type != RTM_NEWADDR)
+				continue;
+
+			ifa = (struct ifaddrmsg *) NLMSG_DATA(nlh);
+			if((int) ifa->ifa_index != ifindex || ifa->ifa_family != AF_INET)
+				continue;
+
+			address = 0;
+			length = IFA_PAYLOAD(nlh);
+
+			for(rta = IFA_RTA(ifa) ; RTA_OK(rta, length) ;
+				rta = RTA_NEXT(rta, length)) {
+				// IFA_LOCAL is the local address on point-to-point links
+				if(rta->rta_type == IFA_LOCAL ||
+					(rta->rta_type == IFA_ADDRESS && address == 0))
+					memcpy(&address, RTA_DATA(rta), sizeof(address));
+			}
+
+			if(addresses_count < addresses_max) {
+				addresses[addresses_count].address = address;
+				addresses[addresses_count].prefix_length = ifa->ifa_prefixlen;
+				addresses_count++;
+			}
+		}
+	}
+
+	return addresses_count;
+}
+
+static int ril_netlink_link_add(struct ril_netlink_batch *batch, int ifindex, int up)
+{
+	struct ifinfomsg ifi;
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index = ifindex;
+	ifi.ifi_flags = up ? IFF_UP : 0;
+	ifi.ifi_change = IFF_UP;
+
+	if(ril_netlink_batch_add(batch, RTM_NEWLINK, 0, &ifi, sizeof(ifi)) == NULL)
+		return -ENOBUFS;
+
+	return 0;
+}
+
+static int ril_netlink_address_add(struct ril_netlink_batch *batch, int type,
+	int ifindex, in_addr_t address, int prefix_length)
+{
+	struct nlmsghdr *nlh;
+	struct ifaddrmsg ifa;
+	int flags;
+	int rc;
+
+	memset(&ifa, 0, sizeof(ifa));
+	ifa.ifa_family = AF_INET;
+	ifa.ifa_prefixlen = prefix_length;
+	ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa.ifa_index = ifindex;
+
+	flags = type == RTM_NEWADDR ? NLM_F_CREATE | NLM_F_REPLACE : 0;
+
+	nlh = ril_netlink_batch_add(batch, type, flags, &ifa, sizeof(ifa));
+	if(nlh == NULL)
+		return -ENOBUFS;
+
+	rc = ril_netlink_attr_add(batch, nlh, IFA_LOCAL, &address, sizeof(address));
+	if(rc < 0)
+		return rc;
+
+	return ril_netlink_attr_add(batch, nlh, IFA_ADDRESS, &address, sizeof(address));
+}
+
+static int ril_netlink_default_route_add(struct ril_netlink_batch *batch,
+	int ifindex, in_addr_t address, int prefix_length, in_addr_t gateway)
+{
+	struct nlmsghdr *nlh;
+	struct rtmsg rtm;
+	in_addr_t netmask;
+	int rc;
+
+	netmask = prefix_length > 0 ? htonl(0xffffffff << (32 - prefix_length)) : 0;
+
+	memset(&rtm, 0, sizeof(rtm));
+	rtm.rtm_family = AF_INET;
+	rtm.rtm_dst_len = 0;
+	rtm.rtm_table = RT_TABLE_MAIN;
+	rtm.rtm_protocol = RTPROT_BOOT;
+	rtm.rtm_type = RTN_UNICAST;
+
+	// Point-to-point links are often given their own address as gateway
+	if(gateway == 0 || gateway == address)
+		rtm.rtm_scope = RT_SCOPE_LINK;
+	else
+		rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+
+	// The gateway may well be outside of the interface subnet
+	if(rtm.rtm_scope == RT_SCOPE_UNIVERSE && (gateway & netmask) != (address & netmask))
+		rtm.rtm_flags = RTNH_F_ONLINK;
+
+	nlh = ril_netlink_batch_add(batch, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE,
+		&rtm, sizeof(rtm));
+	if(nlh == NULL)
+		return -ENOBUFS;
+
+	rc = ril_netlink_attr_add(batch, nlh, RTA_OIF, &ifindex, sizeof(ifindex));
+	if(rc < 0)
+		return rc;
+
+	if(rtm.rtm_scope == RT_SCOPE_UNIVERSE) {
+		rc = ril_netlink_attr_add(batch, nlh, RTA_GATEWAY, &gateway, sizeof(gateway));
+		if(rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Interface configuration
+ */
+
+/**
+ * Converts a netmask to a prefix length
+ */
+int ril_netlink_prefix_length(in_addr_t netmask)
+{
+	uint32_t mask = ntohl(netmask);
+	int prefix_length = 0;
+
+	while(mask & 0x80000000) {
+		prefix_length++;
+		mask <<= 1;
+	}
+
+	return prefix_length;
+}
+
+/**
+ * Brings the interface up, sets its address and its default route in a single
+ * rtnetlink transaction, then checks that the address is in place
+ */
+int ril_netlink_iface_configure(const char *ifname, in_addr_t address,
+	int prefix_length, in_addr_t gateway)
+{
+	struct ril_netlink_address addresses[RIL_NETLINK_ADDRESSES_MAX];
+	struct ril_netlink_batch batch;
+	int ifindex;
+	int fd;
+	int rc;
+	int i;
+
+	if(ifname == NULL || prefix_length < 0 || prefix_length > 32)
+		return -EINVAL;
+
+	ifindex = if_nametoindex(ifname);
+	if(ifindex == 0)
+		return -ENODEV;
+
+	fd = ril_netlink_open();
+	if(fd < 0)
+		return fd;
+
+	ril_netlink_batch_init(&batch);
+
+	rc = ril_netlink_link_add(&batch, ifindex, 1);
+	if(rc < 0)
+		goto complete;
+
+	rc = ril_netlink_address_add(&batch, RTM_NEWADDR, ifindex, address, prefix_length);
+	if(rc < 0)
+		goto complete;
+
+	rc = ril_netlink_default_route_add(&batch, ifindex, address, prefix_length, gateway);
+	if(rc < 0)
+		goto complete;
+
+	rc = ril_netlink_batch_send(fd, &batch);
+	if(rc < 0)
+		goto complete;
+
+	rc = ril_netlink_addresses_dump(fd, ifindex, addresses, RIL_NETLINK_ADDRESSES_MAX);
+	if(rc < 0)
+		goto complete;
+
+	for(i=0 ; i < rc ; i++) {
+		if(addresses[i].address == address &&
+			addresses[i].prefix_length == prefix_length)
+			break;
+	}
+
+	rc = i < rc ? 0 : -EADDRNOTAVAIL;
+
+complete:
+	close(fd);
+
+	return rc;
+}
+
+/**
+ * Removes all the IPv4 addresses of the interface and brings it down,
+ * which also drops its routes, in a single rtnetlink transaction
+ */
+int ril_netlink_iface_down(const char *ifname)
+{
+	struct ril_netlink_address addresses[RIL_NETLINK_ADDRESSES_MAX];
+	struct ril_netlink_batch batch;
+	int addresses_count;
+	int ifindex;
+	int fd;
+	int rc;
+	int i;
+
+	if(ifname == NULL)
+		return -EINVAL;
+
+	ifindex = if_nametoindex(ifname);
+	if(ifindex == 0)
+		return -ENODEV;
+
+	fd = ril_netlink_open();
+	if(fd < 0)
+		return fd;
+
+	addresses_count = ril_netlink_addresses_dump(fd, ifindex,
+		addresses, RIL_NETLINK_ADDRESSES_MAX);
+	if(addresses_count < 0) {
+		rc = addresses_count;
+		goto complete;
+	}
+
+	ril_netlink_batch_init(&batch);
+
+	for(i=0 ; i < addresses_count ; i++) {
+		rc = ril_netlink_address_add(&batch, RTM_DELADDR, ifindex,
+			addresses[i].address, addresses[i].prefix_length);
+		if(rc < 0)
+			goto complete;
+	}
+
+	rc = ril_netlink_link_add(&batch, ifindex, 0);
+	if(rc < 0)
+		goto complete;
+
+	rc = ril_netlink_batch_send(fd, &batch);
+
+complete:
+	close(fd);
+
+	return rc;
+}
+
+/**
+ * Reads the interface traffic counters with a single RTM_GETLINK request
+ * Counters are only 32 bits wide on kernels without IFLA_STATS64
+ */
+int ril_netlink_iface_stats(const char *ifname, struct ril_netlink_stats *stats)
+{
+	struct sockaddr_nl addr;
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	struct rtnl_link_stats *link_stats;
+	struct rtnl_link_stats64 link_stats64;
+	struct ril_netlink_batch batch;
+	struct ifinfomsg ifi_request;
+	char buffer[RIL_NETLINK_BUFFER_SIZE];
+	int found = 0;
+	int length;
+	int ifindex;
+	int fd;
+	int rc;
+
+	if(ifname == NULL || stats == NULL)
+		return -EINVAL;
+
+	ifindex = if_nametoindex(ifname);
+	if(ifindex == 0)
+		return -ENODEV;
+
+	fd = ril_netlink_open();
+	if(fd < 0)
+		return fd;
+
+	memset(&ifi_request, 0, sizeof(ifi_request));
+	ifi_request.ifi_family = AF_UNSPEC;
+	ifi_request.ifi_index = ifindex;
+
+	ril_netlink_batch_init(&batch);
+	nlh = ril_netlink_batch_add(&batch, RTM_GETLINK, 0,
+		&ifi_request, sizeof(ifi_request));
+	if(nlh == NULL) {
+		rc = -ENOBUFS;
+		goto complete;
+	}
+
+	// The link itself is the answer
+	nlh->nlmsg_flags &= ~NLM_F_ACK;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	rc = sendto(fd, batch.buffer, batch.length, 0,
+		(struct sockaddr *) &addr, sizeof(addr));
+	if(rc < 0) {
+		rc = -errno;
+		goto complete;
+	}
+
+	while(!found) {
+		rc = recv(fd, buffer, sizeof(buffer), 0);
+		if(rc < 0) {
+			if(errno == EINTR)
+				continue;
+			rc = -errno;
+			goto complete;
+		}
+
+		for(nlh = (struct nlmsghdr *) buffer ; NLMSG_OK(nlh, (unsigned int) rc) ;
+			nlh = NLMSG_NEXT(nlh, rc)) {
+			if(nlh->nlmsg_seq != batch.seq)
+				continue;
+
+			if(nlh->nlmsg_type == NLMSG_ERROR) {
+				rc = ((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+				goto complete;
+			}
+
+			if(nlh->nlmsg_type != RTM_NEWLINK)
+				continue;
+
+			ifi = (struct ifinfomsg *) NLMSG_DATA(nlh);
+			if(ifi->ifi_index != ifindex)
+				continue;
+
+			memset(stats, 0, sizeof(struct ril_netlink_stats));
+			length = IFLA_PAYLOAD(nlh);
+
+			for(rta = IFLA_RTA(ifi) ; RTA_OK(rta, length) ;
+				rta = RTA_NEXT(rta, length)) {
+				if(rta->rta_type == IFLA_STATS64 &&
+					RTA_PAYLOAD(rta) >= sizeof(link_stats64)) {
+					// The attribute is not always 64 bits aligned
+					memcpy(&link_stats64, RTA_DATA(rta), sizeof(link_stats64));
+
+					stats->rx_bytes = link_stats64.rx_bytes;
+					stats->tx_bytes = link_stats64.tx_bytes;
+					stats->rx_packets = link_stats64.rx_packets;
+					stats->tx_packets = link_stats64.tx_packets;
+					found = 2;
+				} else if(rta->rta_type == IFLA_STATS && found < 2 &&
+					RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats)) {
+					link_stats = (struct rtnl_link_stats *) RTA_DATA(rta);
+
+					stats->rx_bytes = link_stats->rx_bytes;
+					stats->tx_bytes = link_stats->tx_bytes;
+					stats->rx_packets = link_stats->rx_packets;
+					stats->tx_packets = link_stats->tx_packets;
+					found = 1;
+				}
+			}
+
+			if(!found) {
+				rc = -ENODATA;
+				goto complete;
+			}
+			break;
+		}
+	}
+
+	rc = 0;
+
+complete:
+	close(fd);
+
+	return rc;
+}
@@ -0,0 +1,44 @@
+/**
+ * This file is part of samsung-ril.
+ *
+ * samsung-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * samsung-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with samsung-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_NETLINK_H_
+#define _SAMSUNG_RIL_NETLINK_H_
+
+#include <netinet/in.h>
+
+/*
+ * This module only depends on the Linux rtnetlink interface and the C library,
+ * so that it can be built and checked on a host against a dummy interface.
+ * Addresses are given in network byte order, as returned by inet_addr.
+ * All the functions return 0 on success and a negative errno value on failure.
+ */
+
+struct ril_netlink_stats {
+	unsigned long long rx_bytes;
+	unsigned long long tx_bytes;
+	unsigned long long rx_packets;
+	unsigned long long tx_packets;
+};
+
+int ril_netlink_prefix_length(in_addr_t netmask);
+int ril_netlink_iface_configure(const char *ifname, in_addr_t address,
+	int prefix_length, in_addr_t gateway);
+int ril_netlink_iface_down(const char *ifname);
+int ril_netlink_iface_stats(const char *ifname, struct ril_netlink_stats *stats);
+
+#endif
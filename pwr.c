@@ -25,6 +25,12 @@
 #include "samsung-ril.h"
 #include "util.h"
 
+/**
+ * PWR global vars
+ */
+
+int ril_screen_off;
+
 /**
  * Out: RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED
  *   Modem lets us know it's powered on. Though, it's still in LPM and should
@@ -32,8 +38,13 @@
  */
 void ipc_pwr_phone_pwr_up(void)
 {
-	/* H1 baseband firmware bug workaround: sleep for 25ms to allow for nvram to initialize */
-	usleep(25000);
+#ifdef RIL_DEVICE_PWR_UP_DELAY
+	usleep(RIL_DEVICE_PWR_UP_DELAY);
+#endif
+
+	// The modem starts over with its own network settings
+	ril_net_sel_invalidate();
+	ril_gprs_contexts_invalidate();
 
 	ril_state.radio_state = RADIO_STATE_OFF;
 	ril_state.power_mode = POWER_MODE_LPM;
@@ -114,3 +125,46 @@ void ril_request_radio_power(RIL_Token t, void *data, size_t datalen)
 		RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED, NULL, 0);
 	}
 }
+
+/**
+ * Returns 1 if the screen is off, 0 if not
+ */
+int ril_screen_state_off(void)
+{
+	return ril_screen_off;
+}
+
+/**
+ * In: RIL_REQUEST_SCREEN_STATE
+ *   While the screen is off, signal strength, NITZ and data call list
+ *   unsolicited responses are held back to keep the AP asleep.
+ *   Once the screen is back on, send the latest state of each once.
+ */
+void ril_request_screen_state(RIL_Token t, void *data, size_t datalen)
+{
+	int screen_state;
+
+	if(data == NULL || datalen < sizeof(int)) {
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	screen_state = *((int *) data);
+
+	LOGD("Screen is now %s", screen_state ? "on" : "off");
+
+	RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+
+	if(screen_state) {
+		if(!ril_screen_off)
+			return;
+
+		ril_screen_off = 0;
+
+		ril_signal_strength_flush();
+		ril_nitz_flush();
+		ril_data_call_list_flush();
+	} else {
+		ril_screen_off = 1;
+	}
+}
@@ -59,14 +59,56 @@ struct ril_state ril_state;
 
 static pthread_mutex_t ril_mutex = PTHREAD_MUTEX_INITIALIZER; 
 
-static void ril_lock(void) {
+void ril_lock(void) {
 	pthread_mutex_lock(&ril_mutex);
 }
 
-static void ril_unlock(void) {
+void ril_unlock(void) {
 	pthread_mutex_unlock(&ril_mutex);
 }
 
+/**
+ * RIL timed callbacks
+ * libril runs them from its event loop thread, so the RIL lock is taken
+ * around them, just like for the dispatch functions
+ */
+
+struct ril_timed_callback {
+	RIL_TimedCallback callback;
+	void *data;
+};
+
+void ril_timed_callback_run(void *data)
+{
+	struct ril_timed_callback *timed_callback = (struct ril_timed_callback *) data;
+
+	ril_lock();
+	timed_callback->callback(timed_callback->data);
+	ril_unlock();
+
+	free(timed_callback);
+}
+
+int ril_timed_callback(RIL_TimedCallback callback, void *data, int delay_ms)
+{
+	struct ril_timed_callback *timed_callback;
+	struct timeval delay;
+
+	timed_callback = calloc(1, sizeof(struct ril_timed_callback));
+	if(timed_callback == NULL)
+		return -1;
+
+	timed_callback->callback = callback;
+	timed_callback->data = data;
+
+	delay.tv_sec = delay_ms / 1000;
+	delay.tv_usec = (delay_ms % 1000) * 1000;
+
+	RIL_requestTimedCallback(ril_timed_callback_run, timed_callback, &delay);
+
+	return 0;
+}
+
 /**
  * RIL request token
  */
@@ -316,6 +358,12 @@ void srs_dispatch(int fd, struct srs_message *message)
 		case SRS_CONTROL_PING:
 			srs_control_ping(fd, message);
 			break;
+		case SRS_CONTROL_DATA_CALL_STATS:
+			srs_control_data_call_stats(fd, message);
+			break;
+		case SRS_CONTROL_DATA_CALL_TRAFFIC:
+			srs_control_data_call_traffic(fd, message);
+			break;
 		case SRS_SND_SET_CALL_CLOCK_SYNC:
 			srs_snd_set_call_clock_sync(message);
 			break;
@@ -325,6 +373,9 @@ void srs_dispatch(int fd, struct srs_message *message)
 		case SRS_SND_SET_CALL_AUDIO_PATH:
 			srs_snd_set_call_audio_path(message);
 			break;
+		case SRS_NET_PLMN_LIST_REFRESH:
+			srs_net_plmn_list_refresh(message);
+			break;
 		default:
 			LOGD("Unhandled command: (%04x)", message->command);
 			break;
@@ -393,6 +444,7 @@ void onRequest(int request, void *data, size_t datalen, RIL_Token t)
 			break;
 		case RIL_REQUEST_CANCEL_USSD:
 			ril_request_cancel_ussd(t, data, datalen);
+			break;
 		/* SEC */
 		case RIL_REQUEST_GET_SIM_STATUS:
 			ril_request_get_sim_status(t);
@@ -496,10 +548,10 @@ void onRequest(int request, void *data, size_t datalen, RIL_Token t)
 		/* SND */
 		case RIL_REQUEST_SET_MUTE:
 			ril_request_set_mute(t, data, datalen);
+			break;
 		/* OTHER */
 		case RIL_REQUEST_SCREEN_STATE:
-			/* This doesn't affect anything */
-			RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+			ril_request_screen_state(t, data, datalen);
 			break;
 		default:
 			LOGE("Request not implemented: %d\n", request);
@@ -550,6 +602,16 @@ void ril_globals_init(void)
 	ril_requests_tokens_init();
 	ipc_gen_phone_res_expects_init();
 	ril_gprs_connections_init();
+	ril_net_plmn_list_init();
+	ril_signal_strength_init();
+	ril_call_list_init();
+	ril_call_control_init();
+	ril_dtmf_init();
+	ril_card_status_init();
+	ril_facility_lock_init();
+	ril_sim_io_cache_init();
+	ril_sim_io_queue_init();
+	ril_sim_prefetch_init();
 	ril_request_sms_init();
 	ipc_sms_tpid_queue_init();
 }
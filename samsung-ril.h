@@ -28,8 +28,10 @@
 #include <radio.h>
 
 #include "compat.h"
+#include "device.h"
 #include "ipc.h"
 #include "srs.h"
+#include "netlink.h"
 
 /**
  * Defines
@@ -67,6 +69,10 @@ extern struct ril_client *srs_client;
 extern const struct RIL_Env *ril_env;
 extern struct ril_state ril_state;
 
+void ril_lock(void);
+void ril_unlock(void);
+int ril_timed_callback(RIL_TimedCallback callback, void *data, int delay_ms);
+
 /**
  * RIL client
  */
@@ -181,11 +187,17 @@ struct ril_state {
 	struct ipc_net_regist gprs_netinfo;
 	struct ipc_net_current_plmn plmndata;
 
+	int mode_sel;
+	int mode_sel_pending;
+	int mode_sel_valid;
+	int plmn_sel;
+	int plmn_sel_pending;
+	int plmn_sel_valid;
+
 	struct ipc_call_status call_status;
 
 	int gprs_last_failed_cid;
 
-	unsigned char dtmf_tone;
 
 	unsigned char ussd_state;
 };
@@ -223,8 +235,36 @@ void ipc_gen_phone_res(struct ipc_message_info *info);
 void ipc_pwr_phone_pwr_up(void);
 void ipc_pwr_phone_state(struct ipc_message_info *info);
 void ril_request_radio_power(RIL_Token t, void *data, size_t datalen);
+int ril_screen_state_off(void);
+void ril_request_screen_state(RIL_Token t, void *data, size_t datalen);
 
 /* DISP */
+
+#define RIL_SIGNAL_STRENGTH_HYSTERESIS			4
+#define RIL_SIGNAL_STRENGTH_INTERVAL_MAX		60000
+#define RIL_SIGNAL_STRENGTH_HYSTERESIS_PROPERTY		"ril.signal.hysteresis"
+#define RIL_SIGNAL_STRENGTH_INTERVAL_MAX_PROPERTY	"ril.signal.interval_max"
+
+struct ril_signal_strength {
+	RIL_SignalStrength ss;
+	int valid;
+
+	RIL_SignalStrength reported_ss;
+	long long reported_timestamp;
+
+	int hysteresis;
+	int interval_max;
+
+	int pending;
+	int scheduled;
+
+	unsigned int reported_count;
+	unsigned int suppressed_count;
+	unsigned int suppressed_count_total;
+};
+
+void ril_signal_strength_init(void);
+void ril_signal_strength_flush(void);
 void ril_request_signal_strength(RIL_Token t);
 void ipc_disp_icon_info(struct ipc_message_info *info);
 void ipc_disp_rssi_info(struct ipc_message_info *info);
@@ -237,7 +277,15 @@ void ril_request_baseband_version(RIL_Token t);
 void ipc_misc_me_version(struct ipc_message_info *info);
 void ril_request_get_imsi(RIL_Token t);
 void ipc_misc_me_imsi(struct ipc_message_info *info);
+
+struct ril_nitz {
+	struct ipc_misc_time_info time_info;
+	long long timestamp;
+	int pending;
+};
+
 void ipc_misc_time_info(struct ipc_message_info *info);
+void ril_nitz_flush(void);
 
 /* SAT */
 void respondSatProactiveCmd(struct ipc_message_info *request);
@@ -252,6 +300,153 @@ void ril_request_cancel_ussd(RIL_Token t, void *data, size_t datalen);
 void ipc_ss_ussd(struct ipc_message_info *info);
 
 /* SEC */
+
+#define RIL_SIM_IO_CACHE_SIZE		64
+#define RIL_SIM_IO_CACHE_PROBE		8
+#define RIL_SIM_IO_PATH_LEN		16
+#define RIL_SIM_IO_DATA_MAX		256
+
+#define SIM_COMMAND_READ_BINARY		0xB0
+#define SIM_COMMAND_READ_RECORD		0xB2
+#define SIM_COMMAND_GET_RESPONSE	0xC0
+#define SIM_COMMAND_UPDATE_BINARY	0xD6
+#define SIM_COMMAND_UPDATE_RECORD	0xDC
+
+struct ril_sim_io_key {
+	int command;
+	int fileid;
+	int p1;
+	int p2;
+	int p3;
+	char path[RIL_SIM_IO_PATH_LEN];
+};
+
+struct ril_sim_io_cache_entry {
+	int valid;
+	unsigned int stamp;
+	struct ril_sim_io_key key;
+	int prefetched;
+	int used;
+
+	int sw1;
+	int sw2;
+	int length;
+	unsigned char data[RIL_SIM_IO_DATA_MAX];
+};
+
+struct ril_sim_io_cache {
+	struct ril_sim_io_cache_entry entries[RIL_SIM_IO_CACHE_SIZE];
+	unsigned int stamp;
+
+	unsigned int hits;
+	unsigned int misses;
+};
+
+#define RIL_SIM_IO_WINDOW		4
+#define RIL_SIM_IO_WINDOW_MAX		16
+#define RIL_SIM_IO_TIMEOUT		10000
+#define RIL_SIM_IO_SLOW			1000
+#define RIL_SIM_IO_STATS_PERIOD		100
+#define RIL_SIM_IO_MESSAGE_LEN		262
+#define RIL_SIM_IO_QUEUE_MAX		64
+
+struct ril_sim_io_request {
+	RIL_Token token;
+	int aseq;
+	int fileid;
+	int write;
+
+	long long queued_timestamp;
+	long long sent_timestamp;
+
+	int prefetch;
+
+	// The answer is stored in the cache under key
+	int cache;
+	struct ril_sim_io_key key;
+
+	unsigned char message[RIL_SIM_IO_MESSAGE_LEN];
+	int length;
+
+	struct ril_sim_io_request *next;
+};
+
+struct ril_sim_io_queue {
+	struct ril_sim_io_request *queued;
+	struct ril_sim_io_request *inflight;
+	int queued_count;
+	int inflight_count;
+	int window;
+	int timer;
+
+	unsigned int count;
+	long long wait_total;
+	long long latency_total;
+	long long latency_max;
+};
+
+#define RIL_SIM_PREFETCH_MAX		32
+#define RIL_SIM_PREFETCH_RECORDS_MAX	16
+#define RIL_SIM_PREFETCH_REPORT_DELAY	60000
+
+struct ril_sim_prefetch_file {
+	int fileid;
+	char path[RIL_SIM_IO_PATH_LEN];
+};
+
+struct ril_sim_prefetch {
+	struct ril_sim_prefetch_file files[RIL_SIM_PREFETCH_MAX];
+	int files_count;
+
+	unsigned int requests;
+	unsigned int stored;
+	unsigned int used;
+};
+
+struct ril_card_status {
+	RIL_CardStatus card_status;
+	int valid;
+
+	int pin1_attempts;
+	int pin2_attempts;
+	int puk1_attempts;
+
+	unsigned char lock_types[0x100];
+};
+
+enum ril_facility {
+	RIL_FACILITY_SC,
+	RIL_FACILITY_FD,
+	RIL_FACILITY_PN,
+	RIL_FACILITY_PU,
+	RIL_FACILITY_PP,
+	RIL_FACILITY_PC,
+	RIL_FACILITY_COUNT,
+};
+
+struct ril_facility_desc {
+	char *name;
+	unsigned char lock_type;
+	unsigned char pin_type;
+};
+
+struct ril_facility_lock {
+	// -1 when unknown
+	int status[RIL_FACILITY_COUNT];
+
+	// Requested lock state for each pending SET, by aseq
+	signed char pending_facility[0x100];
+	unsigned char pending_status[0x100];
+};
+
+void ril_card_status_init(void);
+void ril_facility_lock_init(void);
+void ril_facility_lock_invalidate(void);
+void ril_sim_io_cache_init(void);
+void ril_sim_io_cache_invalidate(void);
+void ril_sim_io_queue_init(void);
+void ril_sim_prefetch_init(void);
+void ril_sim_prefetch_start(void);
 void ril_state_update(SIM_Status status);
 void ipc_sec_pin_status(struct ipc_message_info *info);
 void ril_request_get_sim_status(RIL_Token t);
@@ -268,6 +463,24 @@ void ipc_sec_phone_lock_complete(struct ipc_message_info *info);
 void ril_request_set_facility_lock(RIL_Token t, void *data, size_t datalen);
 
 /* NET */
+
+#define RIL_NET_PLMN_LIST_TTL		120000
+#define RIL_NET_PLMN_LIST_TIMEOUT	180000
+#define RIL_NET_PLMN_LIST_TOKENS_MAX	5
+
+struct ril_net_plmn_list {
+	char **entries;
+	int entries_count;
+	long long timestamp;
+
+	RIL_Token tokens[RIL_NET_PLMN_LIST_TOKENS_MAX];
+	int tokens_count;
+	long long scan_timestamp;
+};
+
+void ril_net_plmn_list_init(void);
+void ril_net_plmn_list_invalidate(void);
+void ril_net_sel_invalidate(void);
 void ril_plmn_split(char *plmn_data, char **plmn, unsigned int *mcc, unsigned int *mnc);
 void ril_plmn_string(char *plmn_data, char *response[3]);
 unsigned char ril_plmn_act_get(char *plmn_data);
@@ -285,6 +498,7 @@ void ril_request_query_network_selection_mode(RIL_Token t);
 void ipc_net_plmn_sel(struct ipc_message_info *info);
 void ril_request_set_network_selection_automatic(RIL_Token t);
 void ril_request_set_network_selection_manual(RIL_Token t, void *data, size_t datalen);
+void srs_net_plmn_list_refresh(struct srs_message *message);
 
 /* SMS */
 struct ril_request_sms {
@@ -327,6 +541,104 @@ void ipc_sms_deliver_report(struct ipc_message_info *info);
 void ipc_sms_device_ready(struct ipc_message_info *info);
 
 /* Call */
+
+#define RIL_CALL_LIST_MAX		7
+#define RIL_CALL_NUMBER_LEN		86
+#define RIL_CALL_STATE_CHANGED_WINDOW	100
+
+struct ril_call_entry {
+	RIL_Call call;
+	char number[RIL_CALL_NUMBER_LEN + 1];
+	int used;
+};
+
+struct ril_call_list {
+	struct ril_call_entry entries[RIL_CALL_LIST_MAX];
+	RIL_Call *calls[RIL_CALL_LIST_MAX];
+
+	// The table matches the modem and can be answered without IPC_CALL_LIST
+	int valid;
+
+	// Calls as last answered to RILJ
+	struct ril_call_entry sent_entries[RIL_CALL_LIST_MAX];
+	int sent_valid;
+
+	int changed;
+	int scheduled;
+};
+
+enum ril_call_control_type {
+	RIL_CALL_CONTROL_DIAL,
+	RIL_CALL_CONTROL_ANSWER,
+	RIL_CALL_CONTROL_HANGUP,
+	RIL_CALL_CONTROL_COUNT,
+};
+
+#define RIL_CALL_CONTROL_SLOW		2000
+
+struct ril_call_control {
+	// -1 when no call control request is pending
+	int type;
+	unsigned char aseq;
+
+	long long request_timestamp;
+	long long ack_timestamp;
+};
+
+struct ril_call_control_stats {
+	unsigned int count;
+	long long ack_total;
+	long long status_total;
+	long long status_max;
+};
+
+#define RIL_DTMF_QUEUE_SIZE		32
+#define RIL_DTMF_BURST_MAX		16
+#define RIL_DTMF_STOP_DELAY		1
+#define RIL_DTMF_TIMEOUT		5000
+
+enum ril_dtmf_type {
+	RIL_DTMF_BURST,
+	RIL_DTMF_START,
+	RIL_DTMF_STOP,
+};
+
+struct ril_dtmf_request {
+	RIL_Token token;
+	int type;
+	unsigned char tone;
+};
+
+struct ril_dtmf {
+	struct ril_dtmf_request queue[RIL_DTMF_QUEUE_SIZE];
+	int head;
+	int count;
+
+	// Message sent to the modem, waiting for its answer
+	int busy;
+	int sent_type;
+	unsigned char sent_aseq;
+	long long sent_timestamp;
+	unsigned int sent_serial;
+	RIL_Token sent_tokens[RIL_DTMF_BURST_MAX];
+	int sent_count;
+
+	int scheduled;
+
+	// Continuous tone being played and the call it was started on
+	unsigned char tone;
+	int tone_call;
+};
+
+void ril_call_list_init(void);
+void ril_call_list_invalidate(void);
+void ril_call_state_changed(void);
+void ril_call_control_init(void);
+void ipc_call_control_complete(struct ipc_message_info *info);
+void ril_dtmf_init(void);
+void ril_dtmf_call_status(struct ipc_call_status *call_status);
+void ipc_call_burst_dtmf_complete(struct ipc_message_info *info);
+void ipc_call_cont_dtmf_complete(struct ipc_message_info *info);
 void ipc_call_incoming(struct ipc_message_info *info);
 void ipc_call_status(struct ipc_message_info *info);
 void ril_request_dial(RIL_Token t, void *data, size_t datalen);
@@ -349,21 +661,100 @@ void srs_snd_set_call_audio_path(struct srs_message *message);
 
 /* GPRS */
 
+#ifdef RIL_DEVICE_GPRS_CID_MAX
+#define RIL_GPRS_CONNECTIONS_MAX	RIL_DEVICE_GPRS_CID_MAX
+#else
+#define RIL_GPRS_CONNECTIONS_MAX	8
+#endif
+#define RIL_GPRS_INTERFACE_LEN		16
+
+typedef enum {
+	RIL_GPRS_CONNECTION_FREE	= 0,
+	RIL_GPRS_CONNECTION_SETUP	= 1,
+	RIL_GPRS_CONNECTION_CONFIGURING	= 2,
+	RIL_GPRS_CONNECTION_ENABLED	= 3,
+	RIL_GPRS_CONNECTION_TEARDOWN	= 4,
+	RIL_GPRS_CONNECTION_FAILED	= 5,
+} ril_gprs_connection_state;
+
+struct ril_gprs_traffic {
+	struct ril_netlink_stats stats;
+	long long timestamp;
+	long long rx_timestamp;
+	unsigned long long rx_tx_packets;
+	int stalled;
+};
+
 struct ril_gprs_connection {
 	int cid;
-	int enabled;
+	ril_gprs_connection_state state;
 	RIL_LastDataCallActivateFailCause fail_cause;
-	char *interface;
+	char interface[RIL_GPRS_INTERFACE_LEN];
 
 	RIL_Token token;
+	RIL_Token teardown_token;
+	unsigned int generation;
+
+	long long setup_timestamp;
+	long long stage_timestamps[SRS_DATA_CALL_STAGE_TOTAL];
+
+	struct ril_gprs_traffic traffic;
+
 	struct ipc_gprs_pdp_context_set context;
 	struct ipc_gprs_define_pdp_context define_context;
 	struct ipc_gprs_ip_configuration ip_configuration;
 };
 
+typedef enum {
+	RIL_GPRS_JOB_ENABLE,
+	RIL_GPRS_JOB_DISABLE,
+} ril_gprs_job_type;
+
+struct ril_gprs_job {
+	ril_gprs_job_type type;
+	int cid;
+	unsigned int generation;
+
+	struct ipc_gprs_ip_configuration ip_configuration;
+	char interface[RIL_GPRS_INTERFACE_LEN];
+
+	int rc;
+	RIL_Data_Call_Response setup_data_call_response;
+	long long interface_timestamp;
+	long long properties_timestamp;
+
+	struct ril_gprs_job *next;
+};
+
+#define RIL_DATA_CALL_LIST_RECONCILE_INTERVAL	300000
+#define RIL_DATA_CALL_LIST_CHANGED_WINDOW	500
+
+#define RIL_GPRS_SETUP_STATS_APN_MAX	8
+#define RIL_GPRS_SETUP_SLOW		5000
+
+#define RIL_GPRS_TRAFFIC_INTERVAL	10000
+#define RIL_GPRS_STALL_WINDOW		60000
+#define RIL_GPRS_STALL_TX_PACKETS	10
+
+struct ril_gprs_data_call_strings {
+	char type[8];
+	char address[16];
+#if RIL_VERSION >= 6
+	char ifname[RIL_GPRS_INTERFACE_LEN];
+	char dnses[32];
+#else
+	char apn[128];
+#endif
+};
+
+struct ril_gprs_defined_context {
+	int valid;
+	struct ipc_gprs_define_pdp_context define_context;
+};
+
 void ril_gprs_connections_init(void);
-int ril_gprs_connection_reg_id(void);
-struct ril_gprs_connection *ril_gprs_connection_add(void);
+void ril_gprs_contexts_invalidate(void);
+struct ril_gprs_connection *ril_gprs_connection_add(char *apn);
 void ril_gprs_connection_del(struct ril_gprs_connection *gprs_connection);
 void ril_request_setup_data_call(RIL_Token t, void *data, int length);
 void ril_request_deactivate_data_call(RIL_Token t, void *data, int length);
@@ -371,8 +762,16 @@ void ipc_gprs_ip_configuration(struct ipc_message_info *info);
 void ipc_gprs_call_status(struct ipc_message_info *info);
 void ril_request_last_data_call_fail_cause(RIL_Token t);
 void ipc_gprs_pdp_context(struct ipc_message_info *info);
+void ril_data_call_list_invalidate(void);
+void ril_data_call_list_reconcile(void);
 void ril_unsol_data_call_list_changed(void);
+void ril_data_call_list_flush(void);
 void ril_request_data_call_list(RIL_Token t);
+void ril_gprs_stage_mark(struct ril_gprs_connection *gprs_connection,
+	enum srs_data_call_stage stage);
+void srs_control_data_call_stats(int fd, struct srs_message *message);
+void ril_gprs_traffic_start(void);
+void srs_control_data_call_traffic(int fd, struct srs_message *message);
 
 /* RFS */
 
@@ -21,10 +21,54 @@
 
 #define LOG_TAG "RIL-SEC"
 #include <utils/Log.h>
+#include <cutils/properties.h>
 
 #include "samsung-ril.h"
 #include "util.h"
 
+/**
+ * SEC global vars
+ */
+
+struct ril_card_status ril_card_status;
+struct ril_facility_lock ril_facility_lock;
+struct ril_sim_io_cache ril_sim_io_cache;
+struct ril_sim_io_queue ril_sim_io_queue;
+struct ril_sim_prefetch ril_sim_prefetch;
+
+static pthread_key_t ril_sim_io_hex_key;
+static pthread_once_t ril_sim_io_hex_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Files read by RILJ once the SIM is ready, as (fileid, path)
+ * This can be replaced with the ril.sim.prefetch property, given as a
+ * comma-separated list of fileid:path in hex, e.g. 6f46:3F007F20,2fe2:3F00
+ */
+static const struct ril_sim_prefetch_file ril_sim_prefetch_defaults[] = {
+	{ 0x2FE2, "3F00" },	// EF_ICCID
+	{ 0x6FAD, "3F007F20" },	// EF_AD
+	{ 0x6F38, "3F007F20" },	// EF_SST
+	{ 0x6F46, "3F007F20" },	// EF_SPN
+	{ 0x6FCD, "3F007F20" },	// EF_SPDI
+	{ 0x6F16, "3F007F20" },	// EF_INFO_CPHS
+	{ 0x6F14, "3F007F20" },	// EF_CPHS_ONS
+	{ 0x6F15, "3F007F20" },	// EF_CSP
+	{ 0x6FC9, "3F007F20" },	// EF_MBI
+	{ 0x6F40, "3F007F10" },	// EF_MSISDN
+};
+
+/*
+ * Facilities, indexed by enum ril_facility
+ */
+static const struct ril_facility_desc ril_facilities[RIL_FACILITY_COUNT] = {
+	{ "SC", IPC_SEC_PIN_SIM_LOCK_SC, IPC_SEC_PIN_TYPE_PIN1 },
+	{ "FD", IPC_SEC_PIN_SIM_LOCK_FD, IPC_SEC_PIN_TYPE_PIN2 },
+	{ "PN", IPC_SEC_PIN_SIM_LOCK_PN, 0 },
+	{ "PU", IPC_SEC_PIN_SIM_LOCK_PU, 0 },
+	{ "PP", IPC_SEC_PIN_SIM_LOCK_PP, 0 },
+	{ "PC", IPC_SEC_PIN_SIM_LOCK_PC, 0 },
+};
+
 SIM_Status ipc2ril_sim_status(struct ipc_sec_pin_status_response *pin_status)
 {
 	switch(pin_status->type) {
@@ -83,6 +127,14 @@ void ril_state_update(SIM_Status status)
 	/* If power mode isn't at least normal, don't update RIL state */
 	if(ril_state.power_mode < POWER_MODE_NORMAL)
 		return;
+
+	if(status != ril_state.sim_status) {
+		ril_sim_io_cache_invalidate();
+
+		// Fill the cache while RILJ is getting ready
+		if(status == SIM_READY)
+			ril_sim_prefetch_start();
+	}
 	
 	ril_state.sim_status = status;
 
@@ -189,6 +241,95 @@ void ipc2ril_card_status(struct ipc_sec_pin_status_response *pin_status, RIL_Car
 	LOGD("Selecting application #%d on %d", (int) sim_status, app_status_array_length);
 }
 
+/**
+ * Card status snapshot:
+ * The RIL_CardStatus answered to RILJ is only built again when the modem
+ * reports a different PIN status, or when the PIN/PUK attempts left
+ * (from IPC_SEC_LOCK_INFO) change, instead of on each request.
+ */
+
+void ril_card_status_init(void)
+{
+	memset(&ril_card_status, 0, sizeof(ril_card_status));
+
+	ril_card_status.pin1_attempts = -1;
+	ril_card_status.pin2_attempts = -1;
+	ril_card_status.puk1_attempts = -1;
+}
+
+void ril_card_status_build(void)
+{
+	RIL_CardStatus *card_status = &(ril_card_status.card_status);
+	RIL_AppStatus *app_status;
+	int index;
+
+	ipc2ril_card_status(&(ril_state.sim_pin_status), card_status);
+
+	index = card_status->gsm_umts_subscription_app_index;
+	if(index >= 0 && index < card_status->num_applications) {
+		app_status = &(card_status->applications[index]);
+
+		if(ril_card_status.puk1_attempts == 0)
+			app_status->pin1 = RIL_PINSTATE_ENABLED_PERM_BLOCKED;
+		else if(ril_card_status.pin1_attempts == 0)
+			app_status->pin1 = RIL_PINSTATE_ENABLED_BLOCKED;
+
+		if(ril_card_status.pin2_attempts == 0)
+			app_status->pin2 = RIL_PINSTATE_ENABLED_BLOCKED;
+	}
+
+	ril_card_status.valid = 1;
+}
+
+void ril_card_status_update(struct ipc_sec_pin_status_response *pin_status)
+{
+	if(ril_card_status.valid && memcmp(&(ril_state.sim_pin_status), pin_status,
+		sizeof(struct ipc_sec_pin_status_response)) == 0)
+		return;
+
+	memcpy(&(ril_state.sim_pin_status), pin_status, sizeof(struct ipc_sec_pin_status_response));
+
+	ril_card_status_build();
+
+	// Locks may have changed along with the SIM
+	ril_facility_lock_invalidate();
+
+	if(ril_state.sim_status == SIM_PIN || ril_state.sim_status == SIM_PUK)
+		ril_facility_lock.status[RIL_FACILITY_SC] = 1;
+}
+
+/*
+ * Gives the attempts counter matching a lock type: PIN1 attempts are PUK
+ * attempts once the SIM asks for the PUK
+ */
+int *ril_card_status_attempts(int lock_type)
+{
+	switch(lock_type) {
+		case IPC_SEC_PIN_TYPE_PIN1:
+			if(ril_state.sim_status == SIM_PUK || ril_state.sim_status == SIM_BLOCKED)
+				return &ril_card_status.puk1_attempts;
+			return &ril_card_status.pin1_attempts;
+		case IPC_SEC_PIN_TYPE_PIN2:
+			return &ril_card_status.pin2_attempts;
+		default:
+			return NULL;
+	}
+}
+
+void ril_card_status_lock_info_get(int aseq, int lock_type)
+{
+	unsigned char buf[9];
+
+	ril_card_status.lock_types[aseq] = lock_type;
+
+	// FIXME: This is not clean at all
+	memset(buf, 0, sizeof(buf));
+	buf[0] = 1;
+	buf[1] = lock_type;
+
+	ipc_fmt_send(IPC_SEC_LOCK_INFO, IPC_TYPE_GET, buf, sizeof(buf), aseq);
+}
+
 void ril_tokens_pin_status_dump(void)
 {
 	LOGD("ril_tokens_pin_status_dump:\n\
@@ -211,7 +352,6 @@ void ipc_sec_pin_status(struct ipc_message_info *info)
 {
 	RIL_Token t = reqGetToken(info->aseq);
 	struct ipc_sec_pin_status_response *pin_status = (struct ipc_sec_pin_status_response *) info->data;
-	RIL_CardStatus card_status;
 	SIM_Status sim_status;
 
 	if(ril_state.power_mode == POWER_MODE_NORMAL && ril_state.tokens.radio_power != (RIL_Token) 0x00) {
@@ -235,7 +375,7 @@ void ipc_sec_pin_status(struct ipc_message_info *info)
 			sim_status = ipc2ril_sim_status(pin_status);
 			ril_state_update(sim_status);
 
-			memcpy(&(ril_state.sim_pin_status), pin_status, sizeof(struct ipc_sec_pin_status_response));
+			ril_card_status_update(pin_status);
 
 			ril_state.tokens.pin_status = RIL_TOKEN_DATA_WAITING;
 			RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED, NULL, 0);
@@ -250,10 +390,10 @@ void ipc_sec_pin_status(struct ipc_message_info *info)
 			ril_state_update(sim_status);
 
 			// Better keeping this up to date
-			memcpy(&(ril_state.sim_pin_status), pin_status, sizeof(struct ipc_sec_pin_status_response));
+			ril_card_status_update(pin_status);
 
-			ipc2ril_card_status(pin_status, &card_status);
-			RIL_onRequestComplete(t, RIL_E_SUCCESS, &card_status, sizeof(RIL_CardStatus));
+			RIL_onRequestComplete(t, RIL_E_SUCCESS, &(ril_card_status.card_status),
+				sizeof(RIL_CardStatus));
 
 			if(ril_state.tokens.pin_status != RIL_TOKEN_DATA_WAITING)
 				ril_state.tokens.pin_status = (RIL_Token) 0x00;
@@ -272,21 +412,17 @@ void ipc_sec_pin_status(struct ipc_message_info *info)
  */
 void ril_request_get_sim_status(RIL_Token t)
 {
-	struct ipc_sec_pin_status_response *pin_status;
-	RIL_CardStatus card_status;
-	SIM_Status sim_status;
+	// The snapshot is kept up to date with the modem notifications
+	if(ril_card_status.valid) {
+		LOGD("Got RILJ request for SIM status, answering with the snapshot");
 
-	if(ril_state.tokens.pin_status == RIL_TOKEN_DATA_WAITING) {
-		LOGD("Got RILJ request for UNSOL data");
-		hex_dump(&(ril_state.sim_pin_status), sizeof(struct ipc_sec_pin_status_response));
-		pin_status = &(ril_state.sim_pin_status);
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, &(ril_card_status.card_status),
+			sizeof(RIL_CardStatus));
 
-		ipc2ril_card_status(pin_status, &card_status);
-
-		RIL_onRequestComplete(t, RIL_E_SUCCESS, &card_status, sizeof(RIL_CardStatus));
-
-		ril_state.tokens.pin_status = (RIL_Token) 0x00;
-	} else if(ril_state.tokens.pin_status == (RIL_Token) 0x00) {
+		if(ril_state.tokens.pin_status == RIL_TOKEN_DATA_WAITING)
+			ril_state.tokens.pin_status = (RIL_Token) 0x00;
+	} else if(ril_state.tokens.pin_status == (RIL_Token) 0x00 ||
+		ril_state.tokens.pin_status == RIL_TOKEN_DATA_WAITING) {
 		LOGD("Got RILJ request for SOL data");
 
 		/* Request data to the modem */
@@ -296,15 +432,613 @@ void ril_request_get_sim_status(RIL_Token t)
 	} else {
 		LOGE("Another request is going on, returning UNSOL data");
 
-		pin_status = &(ril_state.sim_pin_status);
+		ril_card_status_build();
 
-		ipc2ril_card_status(pin_status, &card_status);
-		RIL_onRequestComplete(t, RIL_E_SUCCESS, &card_status, sizeof(card_status));
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, &(ril_card_status.card_status),
+			sizeof(RIL_CardStatus));
 	}
 
 	ril_tokens_pin_status_dump();
 }
 
+/**
+ * SIM I/O cache:
+ * Reads of elementary files that don't change behind our back are answered
+ * from a fixed pool of entries, hashed by (command, fileid, p1, p2, p3, path).
+ * The modem answer is stored when it comes back, under the key kept with the
+ * in-flight request it answers. Entries for a file are dropped when it's updated,
+ * and the whole cache is dropped on SIM status or PIN/lock changes.
+ */
+
+void ril_sim_io_cache_init(void)
+{
+	memset(&ril_sim_io_cache, 0, sizeof(ril_sim_io_cache));
+}
+
+/*
+ * Reads already queued or sent may come back with the former contents
+ */
+void ril_sim_io_queue_uncache(int fileid)
+{
+	struct ril_sim_io_request *request;
+
+	for(request = ril_sim_io_queue.queued ; request != NULL ; request = request->next)
+		if(fileid < 0 || request->key.fileid == fileid)
+			request->cache = 0;
+
+	for(request = ril_sim_io_queue.inflight ; request != NULL ; request = request->next)
+		if(fileid < 0 || request->key.fileid == fileid)
+			request->cache = 0;
+}
+
+void ril_sim_io_cache_invalidate(void)
+{
+	if(ril_sim_io_cache.hits || ril_sim_io_cache.misses)
+		LOGD("Dropping SIM I/O cache: %u hits, %u misses",
+			ril_sim_io_cache.hits, ril_sim_io_cache.misses);
+
+	ril_sim_io_cache_init();
+	ril_sim_io_queue_uncache(-1);
+}
+
+void ril_sim_io_cache_invalidate_file(int fileid)
+{
+	int i;
+
+	for(i=0 ; i < RIL_SIM_IO_CACHE_SIZE ; i++) {
+		if(ril_sim_io_cache.entries[i].valid &&
+			ril_sim_io_cache.entries[i].key.fileid == fileid)
+			ril_sim_io_cache.entries[i].valid = 0;
+	}
+
+	ril_sim_io_queue_uncache(fileid);
+}
+
+int ril_sim_io_file_static(int fileid)
+{
+	switch(fileid) {
+		case 0x2FE2: // EF_ICCID
+		case 0x2F05: // EF_PL
+		case 0x6F05: // EF_LI
+		case 0x6F14: // EF_CPHS_ONS
+		case 0x6F15: // EF_CSP
+		case 0x6F16: // EF_INFO_CPHS
+		case 0x6F18: // EF_CPHS_SPN_SHORT
+		case 0x6F38: // EF_SST
+		case 0x6F3A: // EF_ADN
+		case 0x6F3B: // EF_FDN
+		case 0x6F3E: // EF_GID1
+		case 0x6F40: // EF_MSISDN
+		case 0x6F46: // EF_SPN
+		case 0x6F49: // EF_SDN
+		case 0x6F4A: // EF_EXT1
+		case 0x6F4B: // EF_EXT2
+		case 0x6F4C: // EF_EXT3
+		case 0x6FAD: // EF_AD
+		case 0x6FC5: // EF_PNN
+		case 0x6FC6: // EF_OPL
+		case 0x6FC7: // EF_MBDN
+		case 0x6FC8: // EF_EXT6
+		case 0x6FC9: // EF_MBI
+		case 0x6FCD: // EF_SPDI
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int ril_sim_io_key_setup(const RIL_SIM_IO *sim_io, struct ril_sim_io_key *key)
+{
+	if(sim_io->command != SIM_COMMAND_READ_BINARY &&
+		sim_io->command != SIM_COMMAND_READ_RECORD &&
+		sim_io->command != SIM_COMMAND_GET_RESPONSE)
+		return -1;
+
+	if(!ril_sim_io_file_static(sim_io->fileid))
+		return -1;
+
+	if(sim_io->pin2 != NULL || (sim_io->path != NULL &&
+		strlen(sim_io->path) >= RIL_SIM_IO_PATH_LEN))
+		return -1;
+
+	// Keys are compared as a whole
+	memset(key, 0, sizeof(struct ril_sim_io_key));
+
+	key->command = sim_io->command;
+	key->fileid = sim_io->fileid;
+	key->p1 = sim_io->p1;
+	key->p2 = sim_io->p2;
+	key->p3 = sim_io->p3;
+
+	if(sim_io->path != NULL)
+		strcpy(key->path, sim_io->path);
+
+	return 0;
+}
+
+unsigned int ril_sim_io_key_hash(struct ril_sim_io_key *key)
+{
+	unsigned char *data = (unsigned char *) key;
+	unsigned int hash = 2166136261U;
+	unsigned int i;
+
+	for(i=0 ; i < sizeof(struct ril_sim_io_key) ; i++) {
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+struct ril_sim_io_cache_entry *ril_sim_io_cache_find(struct ril_sim_io_key *key)
+{
+	struct ril_sim_io_cache_entry *entry;
+	unsigned int index;
+	int i;
+
+	index = ril_sim_io_key_hash(key);
+
+	for(i=0 ; i < RIL_SIM_IO_CACHE_PROBE ; i++) {
+		entry = &ril_sim_io_cache.entries[(index + i) % RIL_SIM_IO_CACHE_SIZE];
+
+		if(entry->valid && memcmp(&(entry->key), key, sizeof(struct ril_sim_io_key)) == 0) {
+			entry->stamp = ++ril_sim_io_cache.stamp;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+void ril_sim_io_cache_store(struct ril_sim_io_key *key, int sw1, int sw2,
+	const unsigned char *data, int length, int prefetched)
+{
+	struct ril_sim_io_cache_entry *entry;
+	struct ril_sim_io_cache_entry *victim = NULL;
+	unsigned int index;
+	int i;
+
+	if(length < 0 || length > RIL_SIM_IO_DATA_MAX)
+		return;
+
+	index = ril_sim_io_key_hash(key);
+
+	// Take the same key, a free slot or the least recently used one
+	for(i=0 ; i < RIL_SIM_IO_CACHE_PROBE ; i++) {
+		entry = &ril_sim_io_cache.entries[(index + i) % RIL_SIM_IO_CACHE_SIZE];
+
+		if(!entry->valid || memcmp(&(entry->key), key, sizeof(struct ril_sim_io_key)) == 0) {
+			victim = entry;
+			break;
+		}
+
+		if(victim == NULL || entry->stamp < victim->stamp)
+			victim = entry;
+	}
+
+	memcpy(&(victim->key), key, sizeof(struct ril_sim_io_key));
+	victim->sw1 = sw1;
+	victim->sw2 = sw2;
+	victim->length = length;
+	memcpy(victim->data, data, length);
+	victim->stamp = ++ril_sim_io_cache.stamp;
+	victim->prefetched = prefetched;
+	victim->used = 0;
+	victim->valid = 1;
+
+	if(prefetched)
+		ril_sim_prefetch.stored++;
+}
+
+/*
+ * SIM I/O answers are hex-encoded into a buffer kept for each thread,
+ * large enough for the longest answer, instead of a new one each time
+ */
+
+static void ril_sim_io_hex_key_create(void)
+{
+	pthread_key_create(&ril_sim_io_hex_key, free);
+}
+
+char *ril_sim_io_hex_buffer(void)
+{
+	char *buffer;
+
+	pthread_once(&ril_sim_io_hex_once, ril_sim_io_hex_key_create);
+
+	buffer = pthread_getspecific(ril_sim_io_hex_key);
+	if(buffer != NULL)
+		return buffer;
+
+	buffer = malloc(RIL_SIM_IO_DATA_MAX * 2 + 1);
+	if(buffer == NULL)
+		return NULL;
+
+	pthread_setspecific(ril_sim_io_hex_key, buffer);
+
+	return buffer;
+}
+
+char *ril_sim_io_hex(const unsigned char *data, int length)
+{
+	char *buffer;
+
+	if(length < 0 || length > RIL_SIM_IO_DATA_MAX)
+		return NULL;
+
+	buffer = ril_sim_io_hex_buffer();
+	if(buffer == NULL)
+		return NULL;
+
+	bin2hex(data, length, buffer);
+	buffer[length * 2] = '\0';
+
+	return buffer;
+}
+
+/**
+ * SIM I/O queue:
+ * Up to a window of IPC_SEC_RSIM_ACCESS requests are kept in flight, the
+ * other ones wait in order. A request is held back while an earlier one for
+ * the same file is pending and one of them is an update, so that writes
+ * strictly follow earlier reads and reads never overtake writes.
+ */
+
+void ril_sim_io_queue_init(void)
+{
+	struct ril_sim_io_request *request;
+	char window[PROPERTY_VALUE_MAX];
+
+	// Requests from before the reset are never going to be answered
+	while(ril_sim_io_queue.queued != NULL) {
+		request = ril_sim_io_queue.queued;
+		ril_sim_io_queue.queued = request->next;
+
+		if(request->token != (RIL_Token) 0x00)
+			RIL_onRequestComplete(request->token, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+		free(request);
+	}
+
+	while(ril_sim_io_queue.inflight != NULL) {
+		request = ril_sim_io_queue.inflight;
+		ril_sim_io_queue.inflight = request->next;
+
+		if(request->token != (RIL_Token) 0x00)
+			RIL_onRequestComplete(request->token, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+		free(request);
+	}
+
+	memset(&ril_sim_io_queue, 0, sizeof(ril_sim_io_queue));
+
+	property_get("ril.sim.io_window", window, "");
+	ril_sim_io_queue.window = atoi(window);
+
+	if(ril_sim_io_queue.window <= 0)
+		ril_sim_io_queue.window = RIL_SIM_IO_WINDOW;
+	if(ril_sim_io_queue.window > RIL_SIM_IO_WINDOW_MAX)
+		ril_sim_io_queue.window = RIL_SIM_IO_WINDOW_MAX;
+}
+
+int ril_sim_io_request_conflicts(struct ril_sim_io_request *request,
+	struct ril_sim_io_request *list, struct ril_sim_io_request *end)
+{
+	for( ; list != NULL && list != end ; list = list->next) {
+		if(list->fileid == request->fileid && (list->write || request->write))
+			return 1;
+	}
+
+	return 0;
+}
+
+void ril_sim_io_queue_expire(long long timestamp)
+{
+	struct ril_sim_io_request **request_p = &ril_sim_io_queue.inflight;
+	struct ril_sim_io_request *request;
+
+	while(*request_p != NULL) {
+		request = *request_p;
+
+		if(timestamp - request->sent_timestamp < RIL_SIM_IO_TIMEOUT) {
+			request_p = &(request->next);
+			continue;
+		}
+
+		LOGE("SIM I/O request for file 0x%04x timed out", request->fileid);
+
+		*request_p = request->next;
+		ril_sim_io_queue.inflight_count--;
+
+		if(request->token != (RIL_Token) 0x00)
+			RIL_onRequestComplete(request->token, RIL_E_GENERIC_FAILURE, NULL, 0);
+		free(request);
+	}
+}
+
+void ril_sim_io_queue_timer(void *data);
+
+void ril_sim_io_queue_run(void)
+{
+	struct ril_sim_io_request **request_p = &ril_sim_io_queue.queued;
+	struct ril_sim_io_request *request;
+	long long timestamp;
+
+	timestamp = ril_timestamp_ms();
+
+	ril_sim_io_queue_expire(timestamp);
+
+	while(*request_p != NULL && ril_sim_io_queue.inflight_count < ril_sim_io_queue.window) {
+		request = *request_p;
+
+		if(ril_sim_io_request_conflicts(request, ril_sim_io_queue.inflight, NULL) ||
+			ril_sim_io_request_conflicts(request, ril_sim_io_queue.queued, request)) {
+			request_p = &(request->next);
+			continue;
+		}
+
+		*request_p = request->next;
+		ril_sim_io_queue.queued_count--;
+
+		// Requests only get an aseq when sent, so few are ever in use
+		request->aseq = ril_request_reg_id(request->token);
+
+		request->sent_timestamp = timestamp;
+		request->next = ril_sim_io_queue.inflight;
+		ril_sim_io_queue.inflight = request;
+		ril_sim_io_queue.inflight_count++;
+
+		ipc_fmt_send(IPC_SEC_RSIM_ACCESS, IPC_TYPE_GET, request->message,
+			request->length, request->aseq);
+	}
+
+	// Make sure unanswered requests can't hold the others forever
+	if(ril_sim_io_queue.inflight_count > 0 && !ril_sim_io_queue.timer) {
+		if(ril_timed_callback(ril_sim_io_queue_timer, NULL, RIL_SIM_IO_TIMEOUT) == 0)
+			ril_sim_io_queue.timer = 1;
+	}
+}
+
+void ril_sim_io_queue_timer(void *data)
+{
+	ril_sim_io_queue.timer = 0;
+
+	ril_sim_io_queue_run();
+}
+
+void ril_sim_io_queue_add(struct ril_sim_io_request *request)
+{
+	struct ril_sim_io_request **request_p = &ril_sim_io_queue.queued;
+
+	while(*request_p != NULL)
+		request_p = &((*request_p)->next);
+
+	request->queued_timestamp = ril_timestamp_ms();
+	request->next = NULL;
+	*request_p = request;
+	ril_sim_io_queue.queued_count++;
+
+	ril_sim_io_queue_run();
+}
+
+struct ril_sim_io_request *ril_sim_io_queue_complete(int aseq)
+{
+	struct ril_sim_io_request **request_p = &ril_sim_io_queue.inflight;
+	struct ril_sim_io_request *request;
+	long long latency;
+
+	for( ; *request_p != NULL ; request_p = &((*request_p)->next)) {
+		if((*request_p)->aseq == aseq)
+			break;
+	}
+
+	request = *request_p;
+	if(request == NULL)
+		return NULL;
+
+	*request_p = request->next;
+	ril_sim_io_queue.inflight_count--;
+
+	latency = ril_timestamp_ms() - request->sent_timestamp;
+
+	ril_sim_io_queue.count++;
+	ril_sim_io_queue.wait_total += request->sent_timestamp - request->queued_timestamp;
+	ril_sim_io_queue.latency_total += latency;
+	if(latency > ril_sim_io_queue.latency_max)
+		ril_sim_io_queue.latency_max = latency;
+
+	if(latency >= RIL_SIM_IO_SLOW)
+		LOGE("Slow SIM I/O request for file 0x%04x: %lldms", request->fileid, latency);
+
+	if(ril_sim_io_queue.count % RIL_SIM_IO_STATS_PERIOD == 0)
+		LOGD("SIM I/O: %u requests, avg wait %lldms, avg latency %lldms, max latency %lldms",
+			ril_sim_io_queue.count,
+			ril_sim_io_queue.wait_total / ril_sim_io_queue.count,
+			ril_sim_io_queue.latency_total / ril_sim_io_queue.count,
+			ril_sim_io_queue.latency_max);
+
+	return request;
+}
+
+/**
+ * SIM prefetch:
+ * When the SIM gets ready, the files RILJ is known to read are read ahead
+ * through the SIM I/O queue, with the very same requests RILJ will issue:
+ * GET RESPONSE first, then READ BINARY or READ RECORD according to the file
+ * structure. Answers fill the SIM I/O cache, and a RILJ request for a read
+ * that is still on its way takes it over. The share of prefetched entries
+ * RILJ actually used is logged, so that the list can be tuned.
+ */
+
+void ril_sim_prefetch_init(void)
+{
+	char files[PROPERTY_VALUE_MAX];
+	char *file;
+	char *last;
+	unsigned int fileid;
+	int count;
+	int i;
+
+	memset(&ril_sim_prefetch, 0, sizeof(ril_sim_prefetch));
+
+	property_get("ril.sim.prefetch", files, "");
+
+	if(files[0] == '\0') {
+		count = sizeof(ril_sim_prefetch_defaults) / sizeof(struct ril_sim_prefetch_file);
+
+		for(i=0 ; i < count && i < RIL_SIM_PREFETCH_MAX ; i++)
+			memcpy(&(ril_sim_prefetch.files[i]), &ril_sim_prefetch_defaults[i],
+				sizeof(struct ril_sim_prefetch_file));
+
+		ril_sim_prefetch.files_count = i;
+		return;
+	}
+
+	for(file = strtok_r(files, ",", &last) ; file != NULL &&
+		ril_sim_prefetch.files_count < RIL_SIM_PREFETCH_MAX ;
+		file = strtok_r(NULL, ",", &last)) {
+		i = ril_sim_prefetch.files_count;
+
+		if(sscanf(file, "%x:%15s", &fileid, ril_sim_prefetch.files[i].path) != 2) {
+			LOGE("Invalid SIM prefetch entry: %s", file);
+			continue;
+		}
+
+		ril_sim_prefetch.files[i].fileid = fileid;
+		ril_sim_prefetch.files_count++;
+	}
+}
+
+struct ril_sim_io_request *ril_sim_prefetch_find(struct ril_sim_io_key *key)
+{
+	struct ril_sim_io_request *lists[] = {
+		ril_sim_io_queue.inflight, ril_sim_io_queue.queued
+	};
+	struct ril_sim_io_request *request;
+	int i;
+
+	for(i=0 ; i < 2 ; i++) {
+		for(request = lists[i] ; request != NULL ; request = request->next) {
+			if(request->prefetch && request->token == (RIL_Token) 0x00 &&
+				memcmp(&(request->key), key, sizeof(struct ril_sim_io_key)) == 0)
+				return request;
+		}
+	}
+
+	return NULL;
+}
+
+void ril_sim_prefetch_queue(int command, int fileid, char *path, int p1, int p2, int p3)
+{
+	struct ipc_sec_rsim_access_request *rsim_data;
+	struct ril_sim_io_request *request;
+	struct ril_sim_io_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.command = command;
+	key.fileid = fileid;
+	key.p1 = p1;
+	key.p2 = p2;
+	key.p3 = p3;
+	strncpy(key.path, path, RIL_SIM_IO_PATH_LEN - 1);
+
+	if(ril_sim_io_cache_find(&key) != NULL || ril_sim_prefetch_find(&key) != NULL)
+		return;
+
+	// RILJ will read the others itself
+	if(ril_sim_io_queue.queued_count >= RIL_SIM_IO_QUEUE_MAX) {
+		LOGD("SIM I/O queue is full, not prefetching file 0x%04x", fileid);
+		return;
+	}
+
+	request = calloc(1, sizeof(struct ril_sim_io_request));
+	if(request == NULL)
+		return;
+
+	request->aseq = -1;
+	request->fileid = fileid;
+	request->prefetch = 1;
+	request->cache = 1;
+	memcpy(&(request->key), &key, sizeof(key));
+	request->length = sizeof(*rsim_data);
+
+	rsim_data = (struct ipc_sec_rsim_access_request *) request->message;
+	rsim_data->command = command;
+	rsim_data->fileid = fileid;
+	rsim_data->p1 = p1;
+	rsim_data->p2 = p2;
+	rsim_data->p3 = p3;
+
+	ril_sim_prefetch.requests++;
+
+	ril_sim_io_queue_add(request);
+}
+
+void ril_sim_prefetch_report(void *data)
+{
+	LOGD("SIM prefetch: %u requests, %u entries stored, %u used by RILJ",
+		ril_sim_prefetch.requests, ril_sim_prefetch.stored, ril_sim_prefetch.used);
+}
+
+void ril_sim_prefetch_start(void)
+{
+	int i;
+
+	if(ril_sim_prefetch.files_count == 0)
+		return;
+
+	LOGD("Prefetching %d SIM files", ril_sim_prefetch.files_count);
+
+	ril_sim_prefetch.requests = 0;
+	ril_sim_prefetch.stored = 0;
+	ril_sim_prefetch.used = 0;
+
+	// Same request as RILJ: GET_RESPONSE_EF_SIZE_BYTES is 15
+	for(i=0 ; i < ril_sim_prefetch.files_count ; i++)
+		ril_sim_prefetch_queue(SIM_COMMAND_GET_RESPONSE,
+			ril_sim_prefetch.files[i].fileid, ril_sim_prefetch.files[i].path,
+			0, 0, 15);
+
+	ril_timed_callback(ril_sim_prefetch_report, NULL, RIL_SIM_PREFETCH_REPORT_DELAY);
+}
+
+void ril_sim_prefetch_continue(struct ril_sim_io_request *request, int sw1,
+	const unsigned char *data, int length)
+{
+	int size;
+	int record_size;
+	int records;
+	int i;
+
+	if(request->key.command != SIM_COMMAND_GET_RESPONSE)
+		return;
+
+	if((sw1 != 0x90 && sw1 != 0x91) || length < 15)
+		return;
+
+	size = (data[2] << 8) | data[3];
+
+	switch(data[13]) {
+		// Transparent
+		case 0x00:
+			if(size <= 0 || size > 0xff)
+				return;
+
+			ril_sim_prefetch_queue(SIM_COMMAND_READ_BINARY,
+				request->key.fileid, request->key.path, 0, 0, size);
+			break;
+		// Linear fixed, read in absolute mode
+		case 0x01:
+			record_size = data[14];
+			if(record_size <= 0)
+				return;
+
+			records = size / record_size;
+			for(i=1 ; i <= records && i <= RIL_SIM_PREFETCH_RECORDS_MAX ; i++)
+				ril_sim_prefetch_queue(SIM_COMMAND_READ_RECORD,
+					request->key.fileid, request->key.path, i, 4, record_size);
+			break;
+	}
+}
+
 /**
  * In: RIL_REQUEST_SIM_IO
  *   Request SIM I/O operation.
@@ -318,17 +1052,92 @@ void ril_request_get_sim_status(RIL_Token t)
 void ril_request_sim_io(RIL_Token t, void *data, size_t datalen)
 {
 	const RIL_SIM_IO *sim_io;
-	unsigned char message[262];
+	struct ril_sim_io_request *request;
 	struct ipc_sec_rsim_access_request *rsim_data;
 
 	unsigned char *rsim_payload;
-	int payload_length;
+	int payload_length = 0;
+	int data_length = 0;
+
+	struct ril_sim_io_cache_entry *entry;
+	struct ril_sim_io_key key;
+	RIL_SIM_IO_Response response;
+	int cache = 0;
+
+	if(data == NULL || datalen < sizeof(RIL_SIM_IO)) {
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
 
 	sim_io = (const RIL_SIM_IO*)data;
-	rsim_payload = message + sizeof(*rsim_data);
+
+	// The payload is given in hex and must fit in the message
+	if(sim_io->data != NULL) {
+		data_length = strlen(sim_io->data);
+		payload_length = data_length / 2;
+
+		if(data_length % 2 != 0 || sizeof(struct ipc_sec_rsim_access_request) +
+			payload_length > RIL_SIM_IO_MESSAGE_LEN) {
+			LOGE("Invalid SIM I/O data length: %d", data_length);
+
+			RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+			return;
+		}
+	}
+
+	if(sim_io->command == SIM_COMMAND_UPDATE_BINARY ||
+		sim_io->command == SIM_COMMAND_UPDATE_RECORD) {
+		ril_sim_io_cache_invalidate_file(sim_io->fileid);
+	} else if(ril_sim_io_key_setup(sim_io, &key) == 0) {
+		entry = ril_sim_io_cache_find(&key);
+		if(entry != NULL) {
+			ril_sim_io_cache.hits++;
+
+			if(entry->prefetched && !entry->used) {
+				entry->used = 1;
+				ril_sim_prefetch.used++;
+			}
+
+			response.sw1 = entry->sw1;
+			response.sw2 = entry->sw2;
+			response.simResponse = ril_sim_io_hex(entry->data, entry->length);
+
+			RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(response));
+			return;
+		}
+
+		// The same read may already be on its way
+		request = ril_sim_prefetch_find(&key);
+		if(request != NULL) {
+			request->token = t;
+			ril_sim_prefetch.used++;
+			return;
+		}
+
+		ril_sim_io_cache.misses++;
+		cache = 1;
+	}
+
+	request = calloc(1, sizeof(struct ril_sim_io_request));
+	if(request == NULL) {
+		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	request->token = t;
+	request->aseq = -1;
+	request->fileid = sim_io->fileid;
+	request->cache = cache;
+	if(cache)
+		memcpy(&(request->key), &key, sizeof(key));
+	request->write = (sim_io->command == SIM_COMMAND_UPDATE_BINARY ||
+		sim_io->command == SIM_COMMAND_UPDATE_RECORD);
+	request->length = sizeof(*rsim_data) + payload_length;
+
+	rsim_payload = request->message + sizeof(*rsim_data);
 
 	/* Set up RSIM header */
-	rsim_data = (struct ipc_sec_rsim_access_request*)message;
+	rsim_data = (struct ipc_sec_rsim_access_request*)request->message;
 	rsim_data->command = sim_io->command;
 	rsim_data->fileid = sim_io->fileid;
 	rsim_data->p1 = sim_io->p1;
@@ -336,16 +1145,10 @@ void ril_request_sim_io(RIL_Token t, void *data, size_t datalen)
 	rsim_data->p3 = sim_io->p3;
 
 	/* Add payload if present */
-	if(sim_io->data) {
-		payload_length = (2 * strlen(sim_io->data));
-
-		if(sizeof(*rsim_data) + payload_length > sizeof(message))
-			return;
+	if(sim_io->data)
+		hex2bin(sim_io->data, data_length, rsim_payload);
 
-		hex2bin(sim_io->data, strlen(sim_io->data), rsim_payload);
-	}
-
-	ipc_fmt_send(IPC_SEC_RSIM_ACCESS, IPC_TYPE_GET, (unsigned char*)&message, sizeof(message), reqGetId(t));
+	ril_sim_io_queue_add(request);
 }
 
 /**
@@ -362,24 +1165,55 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 {
 	struct ipc_sec_rsim_access_response *rsim_resp = (struct ipc_sec_rsim_access_response *) info->data;
 	const unsigned char *data_ptr = ((unsigned char *) info->data + sizeof(*rsim_resp));
-	char *sim_resp;
+	struct ril_sim_io_request *request;
 	RIL_SIM_IO_Response response;
 
+	request = ril_sim_io_queue_complete(info->aseq);
+	if(request == NULL) {
+		LOGE("Unexpected SIM I/O answer, ignoring");
+		return;
+	}
+
+	if(info->data == NULL || info->length < sizeof(*rsim_resp) ||
+		info->length < sizeof(*rsim_resp) + rsim_resp->len) {
+		LOGE("Truncated SIM I/O answer");
+
+		if(request->token != (RIL_Token) 0x00)
+			RIL_onRequestComplete(request->token, RIL_E_GENERIC_FAILURE, NULL, 0);
+
+		free(request);
+		ril_sim_io_queue_run();
+		return;
+	}
+
 	response.sw1 = rsim_resp->sw1;
 	response.sw2 = rsim_resp->sw2;
 
-	if(rsim_resp->len) {
-		sim_resp = (char*)malloc(rsim_resp->len * 2 + 1);
-		bin2hex(data_ptr, rsim_resp->len, sim_resp);
-		response.simResponse = sim_resp;
-	} else {
-		response.simResponse = malloc(1);
-		response.simResponse[0] = '\0';
+	// Only keep successful reads
+	if(request->cache) {
+		if(rsim_resp->sw1 == 0x90 || rsim_resp->sw1 == 0x91)
+			ril_sim_io_cache_store(&(request->key), rsim_resp->sw1,
+				rsim_resp->sw2, data_ptr, rsim_resp->len,
+				request->prefetch && request->token == (RIL_Token) 0x00);
 	}
 
-	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, &response, sizeof(response));
+	if(request->prefetch)
+		ril_sim_prefetch_continue(request, rsim_resp->sw1, data_ptr, rsim_resp->len);
+
+	// Nobody asked for this one (yet)
+	if(request->token == (RIL_Token) 0x00) {
+		free(request);
+		ril_sim_io_queue_run();
+		return;
+	}
+
+	response.simResponse = ril_sim_io_hex(data_ptr, rsim_resp->len);
+
+	RIL_onRequestComplete(request->token, RIL_E_SUCCESS, &response, sizeof(response));
 
-	free(response.simResponse);
+	free(request);
+
+	ril_sim_io_queue_run();
 }
 
 /**
@@ -392,19 +1226,37 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 void ipc_sec_pin_status_complete(struct ipc_message_info *info)
 {
 	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
+	int *attempts_p;
 	int rc;
 
 	int attempts = -1;
 
+	// Attempts left were asked for before trying
+	attempts_p = ril_card_status_attempts(ril_card_status.lock_types[info->aseq]);
+	ril_card_status.lock_types[info->aseq] = 0;
+
 	rc = ipc_gen_phone_res_check(phone_res);
 	if(rc < 0) {
 		if((phone_res->code & 0x00ff) == 0x10) {
 			LOGE("Wrong password!");
+
+			if(attempts_p != NULL && *attempts_p > 0) {
+				(*attempts_p)--;
+				attempts = *attempts_p;
+				ril_card_status_build();
+			}
+
 			RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_PASSWORD_INCORRECT, &attempts, sizeof(attempts));
 		} else if((phone_res->code & 0x00ff) == 0x0c) {
 			LOGE("Wrong password and no attempts left!");
 
 			attempts = 0;
+
+			if(attempts_p != NULL) {
+				*attempts_p = 0;
+				ril_card_status_build();
+			}
+
 			RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_PASSWORD_INCORRECT, &attempts, sizeof(attempts));
 
 			RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED, NULL, 0);
@@ -415,6 +1267,15 @@ void ipc_sec_pin_status_complete(struct ipc_message_info *info)
 		return;
 	}
 
+	// Counters are reset by the SIM, they'll be known from the next lock info
+	if(attempts_p != NULL) {
+		*attempts_p = -1;
+		ril_card_status_build();
+	}
+
+	// Files access conditions may have changed
+	ril_sim_io_cache_invalidate();
+
 	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, &attempts, sizeof(attempts));
 }
 
@@ -424,36 +1285,44 @@ void ipc_sec_pin_status_complete(struct ipc_message_info *info)
  */
 void ipc_sec_lock_info(struct ipc_message_info *info)
 {
-	/*
-	 * FIXME: solid way of handling lockinfo and sim unlock response together
-	 * so we can return the number of attempts left in respondSecPinStatus
-	 */
-	int attempts;
 	struct ipc_sec_lock_info_response *lock_info = (struct ipc_sec_lock_info_response *) info->data;
+	int *attempts_p;
 
-	if(lock_info->type == IPC_SEC_PIN_TYPE_PIN1) {
-		attempts = lock_info->attempts;
-		LOGD("%s: PIN1 %d attempts left", __FUNCTION__, attempts);
-	} else {
+	if(info->data == NULL || info->length < sizeof(struct ipc_sec_lock_info_response))
+		return;
+
+	attempts_p = ril_card_status_attempts(lock_info->type);
+	if(attempts_p == NULL) {
 		LOGE("%s: unhandled lock type %d", __FUNCTION__, lock_info->type);
+		return;
 	}
+
+	LOGD("%s: lock type %d: %d attempts left", __FUNCTION__,
+		lock_info->type, lock_info->attempts);
+
+	if(*attempts_p == lock_info->attempts)
+		return;
+
+	*attempts_p = lock_info->attempts;
+
+	if(ril_card_status.valid)
+		ril_card_status_build();
 }
 
 /**
  * In: RIL_REQUEST_ENTER_SIM_PIN
  *   Supplies SIM PIN. Only called if RIL_CardStatus has RIL_APPSTATE_PIN state
  * 
+ * Out: IPC_SEC_LOCK_INFO
+ *   Retrieves PIN1 attempts left, before trying
+ *
  * Out: IPC_SEC_PIN_STATUS SET
  *   Attempts to unlock SIM PIN1
- *
- * Out: IPC_SEC_LOCK_INFO
- *   Retrieves PIN1 lock status
  */
 void ril_request_enter_sim_pin(RIL_Token t, void *data, size_t datalen)
 {
 	struct ipc_sec_pin_status_set pin_status;
 	char *pin = ((char **) data)[0];
-	unsigned char buf[9];
 
 	/* 1. Send PIN */
 	if(strlen(data) > 16) {
@@ -463,18 +1332,13 @@ void ril_request_enter_sim_pin(RIL_Token t, void *data, size_t datalen)
 
 	ipc_sec_pin_status_set_setup(&pin_status, IPC_SEC_PIN_TYPE_PIN1, pin, NULL);
 
+	/* 2. Get lock status first, so that it's known when the PIN is checked */
+	ril_card_status_lock_info_get(reqGetId(t), IPC_SEC_PIN_TYPE_PIN1);
+
 	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_SEC_PIN_STATUS,
 		ipc_sec_pin_status_complete);
 
 	ipc_fmt_send_set(IPC_SEC_PIN_STATUS, reqGetId(t), (unsigned char *) &pin_status, sizeof(pin_status));
-
-	/* 2. Get lock status */
-	// FIXME: This is not clean at all
-	memset(buf, 0, sizeof(buf));
-	buf[0] = 1;
-	buf[1] = IPC_SEC_PIN_TYPE_PIN1;
-
-	ipc_fmt_send(IPC_SEC_LOCK_INFO, IPC_TYPE_GET, buf, sizeof(buf), reqGetId(t));
 }
 
 void ril_request_change_sim_pin(RIL_Token t, void *data, size_t datalen)
@@ -513,12 +1377,65 @@ void ril_request_enter_sim_puk(RIL_Token t, void *data, size_t datalen)
 
 	ipc_sec_pin_status_set_setup(&pin_status, IPC_SEC_PIN_TYPE_PIN1, pin, puk);
 
+	// PUK attempts left, as the SIM is asking for the PUK
+	ril_card_status_lock_info_get(reqGetId(t), IPC_SEC_PIN_TYPE_PIN1);
+
 	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_SEC_PIN_STATUS,
 		ipc_sec_pin_status_complete);
 
 	ipc_fmt_send_set(IPC_SEC_PIN_STATUS, reqGetId(t), (unsigned char *) &pin_status, sizeof(pin_status));
 }
 
+/**
+ * Facility lock cache:
+ * Lock states are kept after the first query, updated on successful sets
+ * and forgotten when the PIN status changes.
+ */
+
+void ril_facility_lock_init(void)
+{
+	memset(&ril_facility_lock, 0, sizeof(ril_facility_lock));
+	memset(ril_facility_lock.pending_facility, -1, sizeof(ril_facility_lock.pending_facility));
+
+	ril_facility_lock_invalidate();
+}
+
+void ril_facility_lock_invalidate(void)
+{
+	int i;
+
+	for(i = 0 ; i < RIL_FACILITY_COUNT ; i++)
+		ril_facility_lock.status[i] = -1;
+}
+
+int ril_facility_from_name(char *name)
+{
+	int i;
+
+	if(name == NULL)
+		return -1;
+
+	for(i = 0 ; i < RIL_FACILITY_COUNT ; i++) {
+		if(name[0] == ril_facilities[i].name[0] && name[1] == ril_facilities[i].name[1]
+			&& name[2] == '\0')
+			return i;
+	}
+
+	return -1;
+}
+
+int ril_facility_from_lock_type(unsigned char lock_type)
+{
+	int i;
+
+	for(i = 0 ; i < RIL_FACILITY_COUNT ; i++) {
+		if(ril_facilities[i].lock_type == lock_type)
+			return i;
+	}
+
+	return -1;
+}
+
 /**
  * In: IPC_SEC_PHONE_LOCK
  *
@@ -528,10 +1445,20 @@ void ril_request_enter_sim_puk(RIL_Token t, void *data, size_t datalen)
 void ipc_sec_phone_lock(struct ipc_message_info *info)
 {
 	int status;
+	int facility;
 	struct ipc_sec_phone_lock_response *lock = (struct ipc_sec_phone_lock_response *) info->data;
-	
+
+	if(info->data == NULL || info->length < sizeof(struct ipc_sec_phone_lock_response)) {
+		RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
 	status = lock->status;
 
+	facility = ril_facility_from_lock_type(lock->type);
+	if(facility >= 0)
+		ril_facility_lock.status[facility] = status;
+
 	RIL_onRequestComplete(reqGetToken(info->aseq), RIL_E_SUCCESS, &status, sizeof(status));
 }
 
@@ -544,31 +1471,43 @@ void ipc_sec_phone_lock(struct ipc_message_info *info)
 void ril_request_query_facility_lock(RIL_Token t, void *data, size_t datalen)
 {
 	struct ipc_sec_phone_lock_get lock_request;
+	int facility;
+	int status;
 
-	char *facility = ((char **) data)[0];
-
-	if(!strcmp(facility, "SC")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_SC;
-	} else if(!strcmp(facility, "FD")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_FD;
-	} else if(!strcmp(facility, "PN")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PN;
-	} else if(!strcmp(facility, "PU")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PU;
-	} else if(!strcmp(facility, "PP")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PP;
-	} else if(!strcmp(facility, "PC")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PC;
-	} else {
-		LOGE("%s: unsupported facility: %s", __FUNCTION__, facility);
+	facility = ril_facility_from_name(((char **) data)[0]);
+	if(facility < 0) {
+		LOGE("%s: unsupported facility: %s", __FUNCTION__, ((char **) data)[0]);
 		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	status = ril_facility_lock.status[facility];
+	if(status >= 0) {
+		LOGD("%s: %s lock status is cached: %d", __FUNCTION__,
+			ril_facilities[facility].name, status);
+		RIL_onRequestComplete(t, RIL_E_SUCCESS, &status, sizeof(status));
+		return;
 	}
+
+	lock_request.type = ril_facilities[facility].lock_type;
+
 	ipc_fmt_send(IPC_SEC_PHONE_LOCK, IPC_TYPE_GET, &lock_request, sizeof(lock_request), reqGetId(t));
 }
 
-// Both functions were the same
-#define ipc_sec_phone_lock_complete \
-	ipc_sec_pin_status_complete
+void ipc_sec_phone_lock_complete(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res = (struct ipc_gen_phone_res *) info->data;
+	int facility;
+
+	facility = ril_facility_lock.pending_facility[info->aseq];
+	ril_facility_lock.pending_facility[info->aseq] = -1;
+
+	if(facility >= 0 && ipc_gen_phone_res_check(phone_res) >= 0)
+		ril_facility_lock.status[facility] = ril_facility_lock.pending_status[info->aseq];
+
+	// Both functions were the same
+	ipc_sec_pin_status_complete(info);
+}
 
 /**
  * In: RIL_REQUEST_SET_FACILITY_LOCK
@@ -579,31 +1518,22 @@ void ril_request_query_facility_lock(RIL_Token t, void *data, size_t datalen)
 void ril_request_set_facility_lock(RIL_Token t, void *data, size_t datalen)
 {
 	struct ipc_sec_phone_lock_set lock_request;
+	int facility;
 
-	char *facility = ((char **) data)[0];
 	char *lock = ((char **) data)[1];
 	char *password = ((char **) data)[2];
 	char *class = ((char **) data)[3];
 
 	memset(&lock_request, 0, sizeof(lock_request));
 
-	if(!strcmp(facility, "SC")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_SC;
-	} else if(!strcmp(facility, "FD")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_FD;
-	} else if(!strcmp(facility, "PN")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PN;
-	} else if(!strcmp(facility, "PU")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PU;
-	} else if(!strcmp(facility, "PP")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PP;
-	} else if(!strcmp(facility, "PC")) {
-		lock_request.type = IPC_SEC_PIN_SIM_LOCK_PC;
-	} else {
-		LOGE("%s: unsupported facility: %s", __FUNCTION__, facility);
+	facility = ril_facility_from_name(((char **) data)[0]);
+	if(facility < 0) {
+		LOGE("%s: unsupported facility: %s", __FUNCTION__, ((char **) data)[0]);
 		RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
 	}
 
+	lock_request.type = ril_facilities[facility].lock_type;
 	lock_request.lock = lock[0] == '1' ? 1 : 0;
 	lock_request.length = strlen(password) > sizeof(lock_request.password)
 				? sizeof(lock_request.password)
@@ -611,6 +1541,12 @@ void ril_request_set_facility_lock(RIL_Token t, void *data, size_t datalen)
 
 	memcpy(lock_request.password, password, lock_request.length);
 
+	ril_facility_lock.pending_facility[reqGetId(t)] = facility;
+	ril_facility_lock.pending_status[reqGetId(t)] = lock_request.lock;
+
+	// The password is checked against PIN1 or PIN2
+	ril_card_status.lock_types[reqGetId(t)] = ril_facilities[facility].pin_type;
+
 	ipc_gen_phone_res_expect_to_func(reqGetId(t), IPC_SEC_PHONE_LOCK,
 		ipc_sec_phone_lock_complete);
 
@@ -64,7 +64,7 @@ static int srs_server_send_message(int client_fd, struct srs_message *message)
 	return 0;
 }
 
-static int srs_server_send(int fd, unsigned short command, void *data,
+int srs_server_send(int fd, unsigned short command, void *data,
 	int data_len)
 {
 	struct srs_message message;
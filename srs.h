@@ -31,6 +31,8 @@
 #include <samsung-ril-socket.h>
 
 extern struct ril_client_funcs srs_client_funcs;
+extern int srs_server_send(int fd, unsigned short command, void *data,
+	int data_len);
 extern void srs_control_ping(int fd, struct srs_message *message);
 
 #endif
@@ -0,0 +1,185 @@
+/**
+ * This file is part of samsung-ril.
+ *
+ * samsung-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * samsung-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with samsung-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Host test for the rtnetlink helpers, run against a veth interface:
+ *   ip link add veth0 type veth peer name veth1
+ *   ip link set veth1 up
+ *   samsung-ril-netlink-test veth0
+ * It needs CAP_NET_ADMIN, e.g. as root or in "unshare -rn".
+ * Out of an Android tree, it builds with:
+ *   gcc -I. -o netlink-test tests/netlink-test.c netlink.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "netlink.h"
+
+int failures;
+
+#define CHECK(cond, name) \
+	do { \
+		if(cond) { \
+			printf("PASS: %s\n", name); \
+		} else { \
+			printf("FAIL: %s\n", name); \
+			failures++; \
+		} \
+	} while(0)
+
+int iface_up(const char *ifname)
+{
+	struct ifreq ifr;
+	int fd;
+	int rc;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+
+	rc = ioctl(fd, SIOCGIFFLAGS, &ifr);
+	close(fd);
+
+	if(rc < 0)
+		return -1;
+
+	return (ifr.ifr_flags & IFF_UP) ? 1 : 0;
+}
+
+in_addr_t iface_address(const char *ifname)
+{
+	struct ifreq ifr;
+	int fd;
+	int rc;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0)
+		return INADDR_NONE;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ifr.ifr_addr.sa_family = AF_INET;
+
+	rc = ioctl(fd, SIOCGIFADDR, &ifr);
+	close(fd);
+
+	if(rc < 0)
+		return INADDR_NONE;
+
+	return ((struct sockaddr_in *) &ifr.ifr_addr)->sin_addr.s_addr;
+}
+
+/*
+ * Returns 1 if the default route goes through gateway on ifname, or directly
+ * through ifname when gateway is 0
+ */
+int iface_default_route(const char *ifname, in_addr_t gateway)
+{
+	char line[256];
+	char name[IFNAMSIZ];
+	unsigned int destination, route_gateway;
+	FILE *file;
+	int found = 0;
+
+	file = fopen("/proc/net/route", "r");
+	if(file == NULL)
+		return 0;
+
+	while(fgets(line, sizeof(line), file) != NULL) {
+		if(sscanf(line, "%15s %x %x", name, &destination, &route_gateway) != 3)
+			continue;
+
+		if(strcmp(name, ifname) == 0 && destination == 0 &&
+			route_gateway == gateway)
+			found = 1;
+	}
+
+	fclose(file);
+
+	return found;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ril_netlink_stats stats;
+	const char *ifname = argc > 1 ? argv[1] : "veth0";
+	in_addr_t address = inet_addr("10.64.0.2");
+	in_addr_t address_new = inet_addr("10.64.0.3");
+	in_addr_t gateway = inet_addr("10.64.0.1");
+	int rc;
+
+	CHECK(ril_netlink_prefix_length(inet_addr("255.255.255.0")) == 24, "prefix length /24");
+	CHECK(ril_netlink_prefix_length(inet_addr("255.255.255.255")) == 32, "prefix length /32");
+	CHECK(ril_netlink_prefix_length(inet_addr("0.0.0.0")) == 0, "prefix length /0");
+
+	CHECK(ril_netlink_iface_configure("ril-none0", address, 24, gateway) < 0,
+		"configure missing interface");
+
+	rc = ril_netlink_iface_configure(ifname, address, 24, gateway);
+	CHECK(rc == 0, "configure");
+	CHECK(iface_up(ifname) == 1, "interface up");
+	CHECK(iface_address(ifname) == address, "address set");
+	CHECK(iface_default_route(ifname, gateway), "default route set");
+
+	rc = ril_netlink_iface_stats(ifname, &stats);
+	CHECK(rc == 0, "stats");
+
+	rc = ril_netlink_iface_down(ifname);
+	CHECK(rc == 0, "down");
+	CHECK(iface_up(ifname) == 0, "interface down");
+	CHECK(iface_address(ifname) == INADDR_NONE, "address removed");
+	CHECK(!iface_default_route(ifname, gateway), "default route removed");
+
+	// A new setup on the same interface, as after a reconnection
+	rc = ril_netlink_iface_configure(ifname, address_new, 24, gateway);
+	CHECK(rc == 0, "configure again");
+	CHECK(iface_address(ifname) == address_new, "new address set");
+	CHECK(iface_default_route(ifname, gateway), "default route set again");
+
+	rc = ril_netlink_iface_down(ifname);
+	CHECK(rc == 0, "down again");
+
+	/*
+	 * As set up for GPRS: a /32 with its own address as gateway, which gives
+	 * a link scope default route without any gateway
+	 */
+	rc = ril_netlink_iface_configure(ifname, address, 32, address);
+	CHECK(rc == 0, "configure point-to-point");
+	CHECK(iface_up(ifname) == 1, "point-to-point interface up");
+	CHECK(iface_address(ifname) == address, "point-to-point address set");
+	CHECK(iface_default_route(ifname, 0), "point-to-point default route set");
+
+	rc = ril_netlink_iface_down(ifname);
+	CHECK(rc == 0, "point-to-point down");
+	CHECK(iface_up(ifname) == 0, "point-to-point interface down");
+	CHECK(iface_address(ifname) == INADDR_NONE, "point-to-point address removed");
+	CHECK(!iface_default_route(ifname, 0), "point-to-point default route removed");
+
+	printf("%d failure(s)\n", failures);
+
+	return failures ? 1 : 0;
+}
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #define LOG_TAG "RIL-UTIL"
 #include <utils/Log.h>
@@ -297,3 +298,33 @@ SmsCodingScheme sms_get_coding_scheme(int dataCoding)
 	return SMS_CODING_SCHEME_UNKNOWN;
 }
 
+/**
+ * Returns a monotonic timestamp in milliseconds
+ */
+long long ril_timestamp_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Not defined by older C libraries
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME			7
+#endif
+
+/**
+ * Returns a timestamp in milliseconds that keeps counting during suspend
+ */
+long long ril_boottime_ms(void)
+{
+	struct timespec ts;
+
+	// Older kernels don't know about it
+	if(clock_gettime(CLOCK_BOOTTIME, &ts) < 0)
+		return ril_timestamp_ms();
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -27,6 +27,8 @@ int gsm72ascii(unsigned char *data, char **data_dec, int length);
 int ascii2gsm7(char *data, unsigned char **data_enc, int length);
 void hex_dump(void *data, int size);
 int utf8_write(char *utf8, int offset, int v);
+long long ril_timestamp_ms(void);
+long long ril_boottime_ms(void);
 
 typedef enum {
 	SMS_CODING_SCHEME_UNKNOWN = 0,